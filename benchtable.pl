@@ -0,0 +1,51 @@
+#!/usr/bin/perl -w
+
+# Build a throughput table from the console logs written by
+# "make bench-scaling". Each log is named scaling-<ncpu>.log and
+# holds the "BENCH <workload> rate <value> <unit>" lines printed
+# by scalebench, or "CHECK <workload> FAIL" if a worker failed.
+
+my %rate;
+my @cpus;
+my @workloads;
+
+foreach my $file (@ARGV){
+    $file =~ /scaling-(\d+)\.log$/ || die "bad log name $file";
+    my $n = $1;
+    push @cpus, $n;
+    open(LOG, $file) || die "open $file: $!";
+    while(<LOG>){
+        s/\r//g;
+        if(/^CHECK (\S+) FAIL/){
+            push @workloads, $1 unless grep { $_ eq $1 } @workloads;
+            $rate{$1}{$n} = "FAIL";
+        }
+        next unless /^BENCH (\S+) rate (\d+)/;
+        push @workloads, $1 unless grep { $_ eq $1 } @workloads;
+        $rate{$1}{$n} = $2;
+    }
+    close LOG;
+}
+@cpus = sort { $a <=> $b } @cpus;
+
+printf "%-10s", "workload";
+printf "%14s", "cpus=$_" foreach @cpus;
+print "\n";
+foreach my $w (@workloads){
+    printf "%-10s", $w;
+    my $base = $rate{$w}{$cpus[0]};
+    $base = 0 if defined $base && $base eq "FAIL";
+    foreach my $n (@cpus){
+        my $r = $rate{$w}{$n};
+        if(!defined $r){
+            printf "%14s", "-";
+        } elsif($r eq "FAIL"){
+            printf "%14s", "FAIL";
+        } elsif($base){
+            printf "%8d %4.2fx", $r, $r / $base;
+        } else {
+            printf "%14d", $r;
+        }
+    }
+    print "\n";
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,7 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * A pinned buffer (bpin) stays cached until bunpin.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
@@ -25,71 +26,196 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "slab.h"
 
-struct {
+#define NBUCKET 1021           // prime, so consecutive blocks spread out
+#define BUFMEM  64             // use 1/BUFMEM of memory for buffers
+#define BHASH(dev, blockno) ((((dev) << 20) ^ (blockno)) % NBUCKET)
+
+// Buffers live in hash buckets by (dev, blockno), each with its
+// own lock, so lookups of different blocks do not contend.
+// Every bucket list is kept in LRU order, most recently used first.
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct slabcache cache;
+  struct bucket bucket[NBUCKET];
+  int nbuf;
 } bcache;
 
+static void
+bufctor(void *b)
+{
+  memset(b, 0, sizeof(struct buf));
+  initsleeplock(&((struct buf*)b)->lock, "buffer");
+}
+
+static void
+unlink(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+}
+
+static void
+pushfront(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(bk->head)
+    bk->head->prev = b;
+  bk->head = b;
+}
+
+// The least recently used buffer in bk that nobody holds, or 0.
+// Even if refcnt==0, B_DIRTY indicates a buffer is in use
+// because log.c has modified it but not yet committed it.
+static struct buf*
+victim(struct bucket *bk)
+{
+  struct buf *b, *v;
+
+  v = 0;
+  for(b = bk->head; b; b = b->next)
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+      v = b;
+  return v;
+}
+
+// Size the cache from the amount of physical memory,
+// so must be called after kinit2().
 void
 binit(void)
 {
   struct buf *b;
+  int i, n;
 
-  initlock(&bcache.lock, "bcache");
+  slabinit(&bcache.cache, "bcache", sizeof(struct buf), bufctor);
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  n = phystop / BUFMEM / sizeof(struct buf);
+  if(n < NBUF)
+    n = NBUF;
+  if(n > NBUCKET*8)
+    n = NBUCKET*8;
+  for(i = 0; i < n; i++){
+    if((b = slaballoc(&bcache.cache)) == 0)
+      break;
+    b->blockno = i;
+    pushfront(&bcache.bucket[BHASH(b->dev, b->blockno)], b);
   }
+  if(i < NBUF)
+    panic("binit");
+  bcache.nbuf = i;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
-// In either case, return locked buffer.
+// In either case, return the buffer with a new reference
+// but not locked, or 0 if every buffer is in use.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct bucket *bk, *other;
+  struct buf *b, *v;
+  int i, h;
 
-  acquire(&bcache.lock);
+  h = BHASH(dev, blockno);
+  bk = &bcache.bucket[h];
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      release(&bk->lock);
       return b;
     }
   }
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+  // Not cached; recycle an unused buffer of this bucket.
+  if((b = victim(bk)) != 0)
+    goto found;
+  release(&bk->lock);
+
+  // Take one from another bucket. Only one bucket lock is
+  // held at a time, so there is no lock order to get wrong.
+  v = 0;
+  for(i = 1; i < NBUCKET && v == 0; i++){
+    other = &bcache.bucket[(h + i) % NBUCKET];
+    if(other->head == 0)
+      continue;
+    acquire(&other->lock);
+    if((v = victim(other)) != 0)
+      unlink(other, v);
+    release(&other->lock);
+  }
+  if(v == 0)
+    return 0;
+
+  // Somebody else may have cached the block meanwhile.
+  // Then v just stays in this bucket, unused, with no
+  // identity, so that no lookup can match its old contents.
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      v->dev = 0;
+      v->blockno = ~0;
+      v->flags = 0;
+      pushfront(bk, v);
+      release(&bk->lock);
       return b;
     }
   }
-  panic("bget: no buffers");
+  pushfront(bk, v);
+  b = v;
+
+found:
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  release(&bk->lock);
+  return b;
+}
+
+// Return a locked buffer for the block.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bfind(dev, blockno)) == 0)
+    panic("bget: no buffers");
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Drop a reference to b, which must not be locked by the caller.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    unlink(bk, b);
+    pushfront(bk, b);
+  }
+  release(&bk->lock);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +231,50 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Like bread, but the caller is going to overwrite the
+// whole block, so there is no need to read it from disk.
+struct buf*
+boverwrite(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Start reading the block into the cache and return at once;
+// a later bread() finds it there or waits for it. Does nothing
+// if the block is cached or being read, or no buffer is free.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bfind(dev, blockno)) == 0)
+    return;
+  if(!tryacquiresleep(&b->lock)){
+    bput(b);
+    return;
+  }
+  if(b->flags & (B_VALID|B_DIRTY)){
+    releasesleep(&b->lock);
+    bput(b);
+    return;
+  }
+  b->done = bdone;
+  idesubmit(&b, 1);
+}
+
+// Finish a read started by breadahead(). Called by the
+// disk interrupt, which does not own the buffer's lock.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,8 +285,71 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Write n locked buffers to disk and wait for all of them.
+// Submitting them together keeps the disk busy, instead of
+// waiting for each block before starting the next.
+void
+bwritev(struct buf **b, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&b[i]->lock))
+      panic("bwritev");
+    b[i]->flags |= B_DIRTY;
+  }
+  idesubmit(b, n);
+  for(i = 0; i < n; i++)
+    idesync(b[i]);
+}
+
+// Keep b in the cache even after it is released, because
+// it holds changes that are not on disk yet (see log.c).
+void
+bpin(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
+  b->refcnt++;
+  release(&bk->lock);
+}
+
+void
+bunpin(struct buf *b)
+{
+  bput(b);
+}
+
+// Return a locked buffer for the block that is not part of
+// the cache, so its contents can be written to disk without
+// changing what readers of the block see. Free it with
+// bprivfree().
+struct buf*
+bprivate(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = slaballoc(&bcache.cache)) == 0)
+    panic("bprivate");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  acquiresleep(&b->lock);
+  return b;
+}
+
+void
+bprivfree(struct buf *b)
+{
+  releasesleep(&b->lock);
+  slabfree(&bcache.cache, b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the front of its bucket's MRU list.
 void
 brelse(struct buf *b)
 {
@@ -124,21 +357,7 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 //PAGEBREAK!
 // Blank page.
-
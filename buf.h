@@ -4,9 +4,10 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // hash bucket, LRU order
   struct buf *next;
   struct buf *qnext; // disk queue
+  void (*done)(struct buf*); // called when I/O finishes, see idesubmit
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
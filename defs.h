@@ -7,14 +7,26 @@ struct proc;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
+struct pcidev;
+struct slabcache;
+struct spawnfd;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     boverwrite(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
+void            bwritev(struct buf**, int);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
+struct buf*     bprivate(uint, uint);
+void            bprivfree(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +36,8 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+pde_t*          loadimage(char*, char**, struct vma*, uint*, uint*, uint*);
+void            setprocname(struct proc*, char*);
 
 // file.c
 struct file*    filealloc(void);
@@ -57,17 +71,26 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf**, int);
+void            idesync(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
+void            ioapicenablelevel(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
 // kalloc.c
+extern uint     phystop;
+void            meminit(void);
 char*           kalloc(void);
+char*           kalloc_zeroed(void);
 void            kfree(char*);
+void            kref(char*);
+int             krefcount(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kzeroidle(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -79,6 +102,7 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(uchar, int);
 void            microdelay(int);
 
 // log.c
@@ -86,6 +110,7 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            logflush(void);
 
 // mp.c
 extern int      ismp;
@@ -95,7 +120,23 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint);
+char*           pcacheread(struct inode*, uint);
+void            pcachedrop(struct inode*);
+void            pcacheupdate(struct inode*, uint, char*, uint);
+void            pcachewrite(struct inode*, uint, char*);
+
+// pci.c
+uint            pciread(struct pcidev*, uint);
+void            pciwrite(struct pcidev*, uint, uint);
+int             pcifindid(ushort, ushort, struct pcidev*);
+int             pcifindclass(uchar, uchar, struct pcidev*);
+void            pcienable(struct pcidev*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -108,6 +149,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -122,6 +164,8 @@ void            wakeup(void*);
 void            yield(void);
 int             nice(int);
 int             ps(void);
+int             getruntime(int);
+int             spawn(char*, char**, struct spawnfd*, int);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -135,9 +179,15 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void            slabinit(struct slabcache*, char*, uint, void (*)(void*));
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -153,6 +203,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argptrw(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -172,6 +223,13 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+extern int      virtioirq;
+int             virtioinit(void);
+void            virtiointr(void);
+void            virtiosubmit(struct buf**, int);
+void            virtiosync(struct buf*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -181,12 +239,21 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, struct vma*);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
+void            schedswitchuvm(struct proc*);
+void            tlbintr(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             pgfault(struct proc*, uint, uint);
+int             uvmprefault(struct proc*, uint, uint, int);
+uint            uvmend(struct proc*, uint);
+int             mmap(struct proc*, uint, int, struct inode*, uint);
+int             munmap(struct proc*, uint, uint);
+void            vmaflush(struct proc*);
+void            vmadup(struct vma*, struct vma*);
+void            vmarelease(struct vma*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -7,27 +7,34 @@
 #include "x86.h"
 #include "elf.h"
 
-int
-exec(char *path, char **argv)
+// Build a new user address space running the program at path,
+// with argv pushed on its stack. Used by exec() and spawn().
+// The program's segments are not read here: they are recorded
+// in vma and paged in from the file on first touch.
+// On success returns the new page table and fills in vma, the
+// image size, entry point and initial stack pointer; returns 0
+// on failure.
+pde_t*
+loadimage(char *path, char **argv, struct vma *vma, uint *szp,
+          uint *eip, uint *esp)
 {
-  char *s, *last;
-  int i, off;
+  int i, off, nvma;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  pde_t *pgdir;
 
   begin_op();
 
   if((ip = namei(path)) == 0){
     end_op();
     cprintf("exec: fail\n");
-    return -1;
+    return 0;
   }
   ilock(ip);
   pgdir = 0;
+  memset(vma, 0, NVMA*sizeof(vma[0]));
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,8 +45,9 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map program segments.
   sz = 0;
+  nvma = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,12 +57,23 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr < PGROUNDUP(sz) || ph.vaddr + ph.memsz >= KERNBASE)
+      goto bad;
+    if(ph.memsz == 0)
+      continue;
+    if(nvma >= NVMA)
       goto bad;
+    vma[nvma].start = ph.vaddr;
+    vma[nvma].end = PGROUNDUP(ph.vaddr + ph.memsz);
+    vma[nvma].ip = idup(ip);
+    vma[nvma].off = ph.off;
+    vma[nvma].filesz = ph.filesz;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      vma[nvma].flags = VMA_WRITE;
+    nvma++;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -87,28 +106,64 @@ exec(char *path, char **argv)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
-  // Save program name for debugging.
+  *szp = sz;
+  *eip = elf.entry;  // main
+  *esp = sp;
+  return pgdir;
+
+ bad:
+  if(pgdir)
+    freevm(pgdir);
+  if(ip){
+    iunlockput(ip);
+    vmarelease(vma);
+    end_op();
+  } else {
+    begin_op();
+    vmarelease(vma);
+    end_op();
+  }
+  return 0;
+}
+
+// Set the debugging name of p to the last element of path.
+void
+setprocname(struct proc *p, char *path)
+{
+  char *s, *last;
+
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
+}
+
+int
+exec(char *path, char **argv)
+{
+  uint sz, eip, esp;
+  pde_t *pgdir, *oldpgdir;
+  struct vma vma[NVMA];
+  struct proc *curproc = myproc();
+
+  if((pgdir = loadimage(path, argv, vma, &sz, &eip, &esp)) == 0)
+    return -1;
+
+  // Save program name for debugging.
+  setprocname(curproc, path);
 
   // Commit to the user image.
+  vmaflush(curproc);
+  begin_op();
+  vmarelease(curproc->vma);
+  end_op();
+  memmove(curproc->vma, vma, sizeof(vma));
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
+  curproc->tf->eip = eip;
+  curproc->tf->esp = esp;
   switchuvm(curproc);
   freevm(oldpgdir);
   return 0;
-
- bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
-    end_op();
-  }
-  return -1;
 }
@@ -16,6 +16,13 @@ struct inode {
   int ref;            // Reference count
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int npages;         // pages in the page cache, see pcache.c
+  struct inode *hnext;   // icache hash chain
+  struct inode *lprev;   // icache LRU list, if ref is 0
+  struct inode *lnext;
+  uint ranext;        // block after the last one read, see readahead()
+  uint rawin;         // read-ahead window in blocks, 0 if not sequential
+  uint raend;         // blocks before this have been read ahead
 
   short type;         // copy of disk inode
   short major;
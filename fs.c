@@ -18,6 +18,7 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
+#include "slab.h"
 #include "buf.h"
 #include "file.h"
 
@@ -44,39 +45,106 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = boverwrite(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// bsum summarizes the bitmap in memory: the number of free
+// blocks under each bitmap block, so balloc() skips full ones
+// without reading them, and a cursor per CPU where it last
+// allocated, so that CPUs allocating at the same time tend to
+// work in different parts of the disk.
+
+struct {
+  struct spinlock lock;
+  uint nbmap;         // bitmap blocks
+  ushort *nfree;      // free blocks per bitmap block
+  uint cursor[NCPU];
+} bsum;
+
+// Count the free blocks. Called once at boot,
+// after the log has been recovered.
+static void
+bsuminit(uint dev)
+{
+  struct buf *bp;
+  uint b, bi, i;
+
+  initlock(&bsum.lock, "bsum");
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap > PGSIZE / sizeof(ushort) || (bsum.nfree = (ushort*)kalloc()) == 0)
+    panic("bsuminit");
+  for(i = 0; i < bsum.nbmap; i++){
+    bsum.nfree[i] = 0;
+    bp = bread(dev, sb.bmapstart + i);
+    for(bi = 0, b = i*BPB; bi < BPB && b < sb.size; bi++, b++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[i]++;
+    brelse(bp);
+  }
+  for(i = 0; i < NCPU; i++)
+    bsum.cursor[i] = sb.size - sb.nblocks + i * (sb.nblocks / NCPU);
+}
 
-// Allocate a zeroed disk block.
+// Allocate up to n free blocks in a row, at goal if it is free,
+// else at the next free block after goal (after this CPU's
+// cursor if goal is 0). Does not zero them. Returns the first
+// block and sets *got to the number allocated.
 static uint
-balloc(uint dev)
+ballocrun(uint dev, uint goal, uint n, uint *got)
 {
-  int b, bi, m;
+  uint b, bi, i, k, cnt, start;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  if(goal == 0 || goal >= sb.size){
+    pushcli();
+    goal = bsum.cursor[cpuid()];
+    popcli();
+  }
+  for(k = 0; k <= bsum.nbmap; k++){
+    // The block holding goal is searched first from goal,
+    // and last from its start.
+    i = (goal / BPB + k) % bsum.nbmap;
+    start = k == 0 ? goal % BPB : 0;
+    if(bsum.nfree[i] == 0)
+      continue;
+    bp = bread(dev, sb.bmapstart + i);
+    for(bi = start, b = i*BPB + bi; bi < BPB && b < sb.size; bi++, b++){
+      if(bp->data[bi/8] & (1 << (bi % 8)))
+        continue;
+      // Take the free block and those right after it.
+      for(cnt = 0; cnt < n && bi < BPB && b < sb.size &&
+          (bp->data[bi/8] & (1 << (bi % 8))) == 0; cnt++, bi++, b++)
+        bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      acquire(&bsum.lock);
+      bsum.nfree[i] -= cnt;
+      bsum.cursor[cpuid()] = b;
+      release(&bsum.lock);
+      *got = cnt;
+      return b - cnt;
     }
     brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate a zeroed disk block, near goal if possible.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b, got;
+
+  b = ballocrun(dev, goal, 1, &got);
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -92,6 +160,9 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&bsum.lock);
+  bsum.nfree[b / BPB]++;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -120,7 +191,8 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   is unused if ip->ref is zero, and may be recycled for
+//   another inode. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
@@ -128,9 +200,11 @@ bfree(int dev, uint b)
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid. It stays set while the entry is unused, so
+//   the next iget() of the inode need not read it again;
+//   iput() clears it when it frees the inode, and iget()
+//   when it recycles the entry.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,34 +229,107 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
+// entries. Since ip->ref indicates whether an entry is in use,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// Entries are found through a hash table on (dev, inum). An
+// entry whose ref drops to 0 keeps its valid copy of the disk
+// inode and goes on an LRU list; iget() of the same inode takes
+// it back without reading the disk, and entries for other inodes
+// are recycled from the least recently used end. The cache holds
+// up to icache.max entries, set from the memory size, and grows
+// beyond that only while every entry is in use.
+
+#define NIHASH 251             // prime
+#define INODEMEM 256           // use up to 1/INODEMEM of memory for inodes
+#define IHASH(dev, inum) ((((dev) << 16) ^ (inum)) % NIHASH)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *lru;         // most recently released unused entry
+  struct inode *lrutail;     // least recently released
+  int n;                     // entries allocated
+  int max;                   // entries to keep
+  struct slabcache cache;
 } icache;
 
+static void
+inodector(void *ip)
+{
+  memset(ip, 0, sizeof(struct inode));
+  initsleeplock(&((struct inode*)ip)->lock, "inode");
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  slabinit(&icache.cache, "icache", sizeof(struct inode), inodector);
+  icache.max = phystop / INODEMEM / sizeof(struct inode);
+  if(icache.max < NINODE)
+    icache.max = NINODE;
+  if(icache.max > NIHASH*8)
+    icache.max = NIHASH*8;
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+  bsuminit(dev);
+}
+
+// The LRU list and hash chains. Caller holds icache.lock.
+
+static void
+lruremove(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    icache.lru = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    icache.lrutail = ip->lprev;
+  ip->lprev = ip->lnext = 0;
+}
+
+// Put ip at the recently used end of the LRU list,
+// or at the other end if it holds no inode worth keeping.
+static void
+lruinsert(struct inode *ip, int keep)
+{
+  if(icache.lru == 0){
+    ip->lprev = ip->lnext = 0;
+    icache.lru = icache.lrutail = ip;
+  } else if(keep){
+    ip->lprev = 0;
+    ip->lnext = icache.lru;
+    icache.lru->lprev = ip;
+    icache.lru = ip;
+  } else {
+    ip->lnext = 0;
+    ip->lprev = icache.lrutail;
+    icache.lrutail->lnext = ip;
+    icache.lrutail = ip;
+  }
+}
+
+static void
+hashremove(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -241,31 +388,38 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Recycle the least recently used entry once the cache is
+  // full, or grow it if every entry is in use.
+  if(icache.n >= icache.max && (ip = icache.lrutail) != 0){
+    lruremove(ip);
+    hashremove(ip);
+    pcachedrop(ip);
+  } else {
+    if((ip = slaballoc(&icache.cache)) == 0)
+      panic("iget: no inodes");
+    icache.n++;
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->rawin = ip->raend = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -322,8 +476,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry stays
+// cached on the LRU list until it is recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -348,6 +502,17 @@ iput(struct inode *ip)
 
   acquire(&icache.lock);
   ip->ref--;
+  if(ip->ref == 0 && icache.n > icache.max){
+    // Shrink the cache back to icache.max entries.
+    hashremove(ip);
+    icache.n--;
+    release(&icache.lock);
+    pcachedrop(ip);
+    slabfree(&icache.cache, ip);
+    return;
+  }
+  if(ip->ref == 0)
+    lruinsert(ip, ip->valid);
   release(&icache.lock);
 }
 
@@ -368,30 +533,35 @@ iunlockput(struct inode *ip)
 // listed in block ip->addrs[NDIRECT].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block and addr is not 0, make addr the
+// nth block; else return 0.
 static uint
-bmap(struct inode *ip, uint bn)
+bslot(struct inode *ip, uint bn, uint addr)
 {
-  uint addr, *a;
+  uint a0, *a;
   struct buf *bp;
 
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+    if(ip->addrs[bn] == 0)
+      ip->addrs[bn] = addr;
+    return ip->addrs[bn];
   }
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
+    if((a0 = ip->addrs[NDIRECT]) == 0){
+      if(addr == 0)
+        return 0;
+      ip->addrs[NDIRECT] = a0 = balloc(ip->dev, ip->addrs[NDIRECT-1] + 1);
+    }
+    bp = bread(ip->dev, a0);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if(a[bn] == 0 && addr != 0){
+      a[bn] = addr;
       log_write(bp);
     }
+    addr = a[bn];
     brelse(bp);
     return addr;
   }
@@ -399,6 +569,55 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Where to put the nth block of ip: right after block n-1.
+static uint
+bgoal(struct inode *ip, uint bn)
+{
+  uint prev;
+
+  if(bn == 0 || (prev = bslot(ip, bn-1, 0)) == 0)
+    return 0;
+  return prev + 1;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  uint addr;
+
+  if((addr = bslot(ip, bn, 0)) == 0)
+    addr = bslot(ip, bn, balloc(ip->dev, bgoal(ip, bn)));
+  return addr;
+}
+
+// Allocate the blocks that a write of n bytes at off adds to ip,
+// in runs of consecutive disk blocks where possible. Blocks the
+// write fills completely are not zeroed.
+static void
+bextend(struct inode *ip, uint off, uint n)
+{
+  uint bn, last, full0, full1, addr, got, i;
+
+  bn = (ip->size + BSIZE - 1) / BSIZE;
+  last = (off + n - 1) / BSIZE;
+  full0 = (off + BSIZE - 1) / BSIZE;
+  full1 = (off + n) / BSIZE;
+  while(bn <= last){
+    if(bslot(ip, bn, 0) != 0){
+      bn++;
+      continue;
+    }
+    addr = ballocrun(ip->dev, bgoal(ip, bn), last - bn + 1, &got);
+    for(i = 0; i < got; i++, bn++){
+      if(bn < full0 || bn >= full1)
+        bzero(ip->dev, addr + i);
+      bslot(ip, bn, addr + i);
+    }
+  }
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -432,6 +651,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcachedrop(ip);
 }
 
 // Copy stat information from inode.
@@ -447,6 +667,46 @@ stati(struct inode *ip, struct stat *st)
 }
 
 //PAGEBREAK!
+// Read-ahead window limits, in blocks.
+#define RAMIN 4
+#define RAMAX 32
+
+// Called by readi() before it reads blocks bn through last.
+// If the file is being read sequentially, start reading the
+// blocks after last into the buffer cache, so that they are
+// there by the time the reader asks for them. The window
+// doubles on every sequential read, up to RAMAX, and closes
+// when the reader seeks elsewhere.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn, uint last)
+{
+  uint b, end, nblocks;
+
+  if(bn == ip->ranext || bn + 1 == ip->ranext){
+    ip->rawin = ip->rawin ? ip->rawin * 2 : RAMIN;
+    if(ip->rawin > RAMAX)
+      ip->rawin = RAMAX;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+  if(ip->rawin == 0)
+    return;
+
+  // Only blocks inside the file, which bmap() need not allocate.
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  end = last + 1 + ip->rawin;
+  if(end > nblocks)
+    end = nblocks;
+  b = ip->raend > last + 1 ? ip->raend : last + 1;
+  for(; b < end; b++)
+    breadahead(ip->dev, bmap(ip, b));
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 int
@@ -465,6 +725,8 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -494,12 +756,18 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(n > 0)
+    bextend(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(m == BSIZE)
+      bp = boverwrite(ip->dev, bmap(ip, off/BSIZE));
+    else
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
+    pcacheupdate(ip, off, bp->data + off%BSIZE, m);
     brelse(bp);
   }
 
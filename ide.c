@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code. Uses bus-master DMA when the
+// controller supports it, else programmed I/O (PIO).
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +13,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -24,15 +26,52 @@
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+#define IDE_MAXMULT   16   // sectors per READ/WRITE MULTIPLE command
+
+// idequeue is the queue of bufs waiting for the disk, in
+// C-LOOK order: ascending block numbers from the end of the
+// last request, then ascending from the start of the disk.
+// idecur is the request the disk is working on: one or more
+// bufs for consecutive blocks, linked through qnext.
+// You must hold idelock while manipulating the queues.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idecur;
+static uint idehead;       // block after the last request started
+static int idemult = 1;    // sectors per multiple-sector command
+
+// Bus-master DMA. The controller reads a table of physical
+// regions (PRDs), one per buf, and moves the data itself.
+// Registers are relative to idebm, 0 if DMA is not used.
+#define BM_CMD     0
+#define BM_STATUS  2
+#define BM_PRDT    4
+#define BM_START   0x01  // in BM_CMD
+#define BM_READ    0x08  // in BM_CMD: disk to memory
+#define BM_ERR     0x02  // in BM_STATUS
+#define BM_INTR    0x04  // in BM_STATUS
+
+#define NPRD      32     // most blocks per DMA request
+#define PRD_EOT   0x8000 // last entry in table
+
+struct prd {
+  uint addr;             // physical address
+  ushort len;            // byte count
+  ushort flags;
+};
+
+// Aligned to its size, so it does not cross a 64KB boundary.
+static struct prd prdt[NPRD] __attribute__((aligned(NPRD*sizeof(struct prd))));
+static ushort idebm;
 
 static int havedisk1;
+static int havevirtio;     // disk 1 is a virtio disk, see virtio.c
 static void idestart(struct buf*);
+static void ideinsert(struct buf*);
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,13 +86,25 @@ idewait(int checkerr)
   return 0;
 }
 
+static int
+setmultiple(int disk)
+{
+  idewait(0);
+  outb(0x1f6, 0xe0 | (disk<<4));
+  outb(0x1f2, IDE_MAXMULT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  return idewait(1);
+}
+
 void
 ideinit(void)
 {
   int i;
+  struct pcidev pci;
 
   initlock(&idelock, "ide");
   ioapicenable(IRQ_IDE, ncpu - 1);
+  havevirtio = virtioinit();
   idewait(0);
 
   // Check if disk 1 is present
@@ -67,102 +118,249 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Let READ/WRITE MULTIPLE move IDE_MAXMULT sectors per
+  // interrupt, so requests for consecutive blocks can be
+  // merged. Otherwise transfer a block at a time.
+  if(setmultiple(0) == 0 && (!havedisk1 || setmultiple(1) == 0))
+    idemult = IDE_MAXMULT;
+
+  // Use DMA if there is a PCI IDE controller with a
+  // bus-master register block (BAR4).
+  if(pcifindclass(0x01, 0x01, &pci) && (pci.bar[4] & PCI_BAR_IO) &&
+     PCI_BAR_IOADDR(pci.bar[4]) != 0){
+    pcienable(&pci);
+    idebm = PCI_BAR_IOADDR(pci.bar[4]);
+  }
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for the chain of bufs at b, which are
+// for consecutive blocks.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *q;
+  int i, nblock;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
+  nblock = 0;
+  for(q = b; q; q = q->qnext){
+    if(q->blockno >= FSSIZE)
+      panic("incorrect blockno");
+    nblock++;
+  }
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int nsector = nblock * sector_per_block;
+  int read_cmd = (nsector == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsector == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+
+  if (nsector > 255) panic("idestart");
 
-  if (sector_per_block > 7) panic("idestart");
+  if(idebm){
+    i = 0;
+    for(q = b; q; q = q->qnext){
+      prdt[i].addr = V2P(q->data);
+      prdt[i].len = BSIZE;
+      prdt[i].flags = 0;
+      i++;
+    }
+    prdt[i-1].flags = PRD_EOT;
+    outb(idebm+BM_CMD, 0);
+    outl(idebm+BM_PRDT, V2P(prdt));
+    outb(idebm+BM_STATUS, BM_ERR|BM_INTR);  // clear
+    outb(idebm+BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_READ);
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsector);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(idebm){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm+BM_CMD, inb(idebm+BM_CMD) | BM_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(q = b; q; q = q->qnext)
+      outsl(0x1f0, q->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
 }
 
+// Take the next request off idequeue and start it, merging
+// the bufs that follow the first one on disk, in the same
+// direction, into one command of up to idemult sectors.
+// Caller must hold idelock.
+static void
+idedispatch(void)
+{
+  struct buf *b, *last;
+  int n, max;
+
+  if((b = idequeue) == 0)
+    return;
+  max = idebm ? NPRD : idemult / (BSIZE/SECTOR_SIZE);
+  last = b;
+  for(n = 1; n < max; n++){
+    b = last->qnext;
+    if(b == 0 || b->dev != last->dev || b->blockno != last->blockno + 1 ||
+       (b->flags & B_DIRTY) != (last->flags & B_DIRTY))
+      break;
+    last = b;
+  }
+  idecur = idequeue;
+  idequeue = last->qnext;
+  last->qnext = 0;
+  idehead = last->blockno + 1;
+  idestart(idecur);
+}
+
 // Interrupt handler.
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next;
+  void (*done)(struct buf*);
+  int ok, st;
 
-  // First queued buffer is the active request.
+  // idecur is the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if((b = idecur) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+  idecur = 0;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  ok = 1;
+  if(idebm){
+    // Stop the DMA engine and check for errors. If DMA
+    // fails, switch to PIO and try the request again.
+    st = inb(idebm+BM_STATUS);
+    outb(idebm+BM_CMD, 0);
+    outb(idebm+BM_STATUS, BM_ERR|BM_INTR);
+    if((st & BM_ERR) || idewait(1) < 0){
+      cprintf("ide: DMA failed, using PIO\n");
+      idebm = 0;
+      for(; b; b = next){
+        next = b->qnext;
+        ideinsert(b);
+      }
+      idedispatch();
+      release(&idelock);
+      return;
+    }
+  } else if(!(b->flags & B_DIRTY))
+    ok = idewait(1) >= 0;  // Read data if needed.
+
+  for(; b; b = next){
+    next = b->qnext;
+    if(ok && !idebm && !(b->flags & B_DIRTY))
+      insl(0x1f0, b->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf, or tell
+    // whoever submitted it that it is done.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->done){
+      done = b->done;
+      b->done = 0;
+      done(b);
+    } else
+      wakeup(b);
+  }
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on next request in queue.
+  idedispatch();
 
   release(&idelock);
 }
 
+// Insert b into idequeue in C-LOOK order.
+// Caller must hold idelock.
+static void
+ideinsert(struct buf *b)
+{
+  struct buf **pp;
+  int wrap;
+
+  // Blocks before idehead wait for the next sweep.
+  wrap = b->blockno < idehead;
+  for(pp=&idequeue; *pp; pp=&(*pp)->qnext){  //DOC:insert-queue
+    if(((*pp)->blockno < idehead) == wrap){
+      if((*pp)->blockno > b->blockno)
+        break;
+    } else if(!wrap)
+      break;
+  }
+  b->qnext = *pp;
+  *pp = b;
+}
+
 //PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Start I/O on n locked bufs and return without waiting.
+// Each buf is written if B_DIRTY is set, else read.
+// The disk works through them back to back, merging
+// consecutive blocks into one transfer. When a buf is
+// done, ideintr calls b->done(b) if the caller set it, with
+// idelock held and from interrupt context; otherwise use
+// idesync() to wait for it.
 void
-iderw(struct buf *b)
+idesubmit(struct buf **bufs, int n)
 {
-  struct buf **pp;
+  struct buf *b;
+  int i;
 
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+  if(havevirtio && n > 0 && bufs[0]->dev == 1){
+    virtiosubmit(bufs, n);
+    return;
+  }
 
-  acquire(&idelock);  //DOC:acquire-lock
+  acquire(&idelock);
+  for(i = 0; i < n; i++){
+    b = bufs[i];
+    if(!holdingsleep(&b->lock))
+      panic("iderw: buf not locked");
+    if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderw: nothing to do");
+    if(b->dev != 0 && !havedisk1)
+      panic("iderw: ide disk 1 not present");
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+    ideinsert(b);
+  }
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idecur == 0)
+    idedispatch();
+  release(&idelock);
+}
 
-  // Wait for request to finish.
+// Wait for a buf submitted without a done callback.
+void
+idesync(struct buf *b)
+{
+  if(havevirtio && b->dev == 1){
+    virtiosync(b);
+    return;
+  }
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
-
-
   release(&idelock);
 }
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  idesubmit(&b, 1);
+  idesync(b);
+}
@@ -73,3 +73,13 @@ ioapicenable(int irq, int cpunum)
   ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
   ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
 }
+
+// Like ioapicenable, but level-triggered, as PCI interrupts are.
+// The handler must clear the device's interrupt before the EOI,
+// or the interrupt is raised again at once.
+void
+ioapicenablelevel(int irq, int cpunum)
+{
+  ioapicwrite(REG_TABLE+2*irq, INT_LEVEL | (T_IRQ0 + irq));
+  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+}
@@ -17,12 +17,90 @@ struct run {
   struct run *next;
 };
 
+// Each CPU keeps a small cache of free pages so that the common
+// kalloc()/kfree() path does not touch kmem.lock. A cache is only
+// used by its own CPU with interrupts off, so it needs no lock.
+// Pages move between a cache and the global list KBATCH at a time.
+// kalloc() fails once its own cache and the global list are empty,
+// even if other CPUs still cache up to KCACHEMAX pages each.
+//
+// Each CPU also keeps up to KZEROMAX pages that were zeroed while it
+// had nothing to run (see kzeroidle), so kalloc_zeroed() usually
+// does not have to clear a page itself.
+#define KCACHEMAX 64  // most pages a CPU cache holds
+#define KBATCH    32  // pages moved per refill or drain
+#define KZEROMAX  32  // most pre-zeroed pages a CPU cache holds
+
+struct kcache {
+  struct run *freelist;
+  int nfree;
+  struct run *zerolist;  // pages known to be all zeroes
+  int nzero;
+};
+
 struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  struct kcache cache[NCPU];
+  ushort ref[PHYSMAX/PGSIZE];  // mappings of each page, see kref()
 } kmem;
 
+#define PAGEREF(v) (&kmem.ref[V2P(v)/PGSIZE])
+
+// Physical memory map entry from the BIOS (E820).
+struct e820 {
+  uint addr, addrhi;
+  uint len, lenhi;
+  uint type;
+};
+#define E820_RAM 1
+#define E820END  0x7c00  // bootasm.S is loaded here
+
+uint phystop;  // end of physical memory, set by meminit()
+
+// Return the BIOS memory map saved at E820MAP by bootasm.S
+// and set *n to its length, or return 0 if there is none,
+// e.g. because a multiboot loader started the kernel.
+static struct e820*
+e820map(int *n)
+{
+  uint end;
+
+  end = *(ushort*)P2V(E820MAP);
+  if(end <= E820MAP+4 || end > E820END || (end - (E820MAP+4)) % sizeof(struct e820))
+    return 0;
+  *n = (end - (E820MAP+4)) / sizeof(struct e820);
+  return (struct e820*)P2V(E820MAP+4);
+}
+
+// Find the end of usable memory below PHYSMAX in the BIOS
+// memory map, or assume PHYSTOP if there is no map.
+// Called first thing, before kinit1().
+void
+meminit(void)
+{
+  struct e820 *e;
+  uint end;
+  int i, n;
+
+  phystop = 0;
+  if((e = e820map(&n)) != 0){
+    for(i = 0; i < n; i++){
+      if(e[i].type != E820_RAM || e[i].addrhi != 0 || e[i].addr >= PHYSMAX)
+        continue;
+      end = e[i].addr + e[i].len;
+      if(e[i].lenhi != 0 || end < e[i].addr || end > PHYSMAX)
+        end = PHYSMAX;
+      if(end > phystop)
+        phystop = end;
+    }
+  }
+  if(phystop < 4*1024*1024)
+    phystop = PHYSTOP;
+  phystop = PGROUNDDOWN(phystop);
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -36,10 +114,33 @@ kinit1(void *vstart, void *vend)
   freerange(vstart, vend);
 }
 
+// Only memory the BIOS reports as RAM is freed; the range
+// may have holes, like ACPI tables.
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  struct e820 *e;
+  uint lo, hi;
+  int i, n;
+
+  if((e = e820map(&n)) == 0)
+    freerange(vstart, vend);
+  else {
+    for(i = 0; i < n; i++){
+      if(e[i].type != E820_RAM || e[i].addrhi != 0 || e[i].addr >= phystop)
+        continue;
+      lo = e[i].addr;
+      hi = lo + e[i].len;
+      if(e[i].lenhi != 0 || hi < lo || hi > phystop)
+        hi = phystop;
+      if(lo < V2P(vstart))
+        lo = V2P(vstart);
+      if(hi > V2P(vend))
+        hi = V2P(vend);
+      if(lo < hi)
+        freerange(P2V(lo), P2V(hi));
+    }
+  }
   kmem.use_lock = 1;
 }
 
@@ -51,6 +152,41 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+// Move KBATCH pages from the global list into CPU cache c.
+// Must be called with interrupts off on c's CPU.
+static void
+krefill(struct kcache *c)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(c->nfree < KBATCH && (r = kmem.freelist) != 0){
+    kmem.freelist = r->next;
+    r->next = c->freelist;
+    c->freelist = r;
+    c->nfree++;
+  }
+  release(&kmem.lock);
+}
+
+// Give KBATCH pages from CPU cache c back to the global list.
+// Must be called with interrupts off on c's CPU.
+static void
+kdrain(struct kcache *c)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(c->nfree > KCACHEMAX - KBATCH){
+    r = c->freelist;
+    c->freelist = r->next;
+    c->nfree--;
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+  }
+  release(&kmem.lock);
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -60,20 +196,41 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
+  ushort *ref;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
 
+  // A page shared by copy-on-write is only freed by its last user.
+  // With a single reference nobody else can change the count.
+  ref = PAGEREF(v);
+  if(*ref > 1 && __sync_sub_and_fetch(ref, 1) > 0)
+    return;
+  *ref = 0;
+
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+
+  // Until kinit2() there is only one CPU running, and mycpu()
+  // may not work yet, so go straight to the global list.
+  if(!kmem.use_lock){
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    return;
+  }
+
+  pushcli();
+  c = &kmem.cache[cpuid()];
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->nfree > KCACHEMAX)
+    kdrain(c);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +240,106 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
+
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      *PAGEREF(r) = 1;
+    }
+    return (char*)r;
+  }
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  pushcli();
+  c = &kmem.cache[cpuid()];
+  if(c->freelist == 0)
+    krefill(c);
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->nfree--;
+  } else if((r = c->zerolist) != 0){
+    c->zerolist = r->next;
+    c->nzero--;
+  }
+  popcli();
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    *PAGEREF(r) = 1;
   return (char*)r;
 }
 
+// Allocate one 4096-byte page of physical memory filled with zeroes.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+  struct kcache *c;
+  char *v;
+
+  if(kmem.use_lock){
+    pushcli();
+    c = &kmem.cache[cpuid()];
+    r = c->zerolist;
+    if(r){
+      c->zerolist = r->next;
+      c->nzero--;
+    }
+    popcli();
+    if(r){
+      r->next = 0;  // the only non-zero word in the page
+      *PAGEREF(r) = 1;
+      return (char*)r;
+    }
+  }
+
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero one free page into this CPU's pool of zeroed pages.
+// Called by the scheduler when it has nothing to run.
+void
+kzeroidle(void)
+{
+  struct run *r;
+  struct kcache *c;
+
+  if(!kmem.use_lock)
+    return;
+
+  pushcli();
+  c = &kmem.cache[cpuid()];
+  if(c->nzero < KZEROMAX){
+    if(c->freelist == 0)
+      krefill(c);
+    if((r = c->freelist) != 0){
+      c->freelist = r->next;
+      c->nfree--;
+      memset(r, 0, PGSIZE);
+      r->next = c->zerolist;
+      c->zerolist = r;
+      c->nzero++;
+    }
+  }
+  popcli();
+}
+
+// Add a reference to the page at v, which the caller already holds
+// a reference to. Each reference needs its own kfree().
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
+    panic("kref");
+  __sync_add_and_fetch(PAGEREF(v), 1);
+}
+
+// Return the number of references to the page at v.
+int
+krefcount(char *v)
+{
+  return *PAGEREF(v);
+}
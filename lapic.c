@@ -113,6 +113,18 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send an interrupt with the given vector to the CPU with
+// the given APIC ID. Caller must have interrupts disabled, so
+// both halves of the command go to the same local APIC.
+void
+lapicipi(uchar apicid, int vector)
+{
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -9,8 +9,8 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is only closed when there are
+// no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
@@ -18,37 +18,91 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the commit thread has made room.
+//
+// Commits are done by a kernel thread, logthread(), not by
+// the system calls. It closes the open transaction once it has
+// been open for COMMITTICKS ticks, or earlier if it is nearly
+// full or somebody waits in logflush(). Closing copies the
+// logged blocks, which takes no disk I/O; then new system calls
+// go on in the next transaction while the thread writes the
+// copies to the log. end_op() does not wait for the commit, so
+// many small operations share one commit.
+//
+// The log is a circular journal of physical re-do records.
+// Committed blocks are not written to their home locations
+// right away: the thread keeps the newest committed copy of
+// every block in the log, and writes them all home
+// (checkpoints) only when the journal runs out of space or the
+// file system has been idle for CKPTTICKS. A block changed by
+// many transactions in between is written home once.
 //
-// The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+//   header block: position and sequence number of the oldest
+//     record that has not been checkpointed (the tail)
+//   then a ring of records, each:
+//     descriptor block: magic, sequence number, block #s A, B, ...
+//     block A
+//     block B
+//     ...
+// A record's descriptor is written after its blocks, so it is
+// the commit point. Recovery replays records from the tail for
+// as long as their sequence numbers follow on. File data goes
+// through the journal too, so a stale block after the last record
+// might look like a descriptor; the descriptor therefore carries a
+// checksum of the record's blocks, and recovery stops at the first
+// record whose blocks don't match it.
+
+#define LOGMAGIC 0x6c6f6721
+
+// Contents of a descriptor block, also used
+// to keep track in memory of logged block# before commit.
 struct logheader {
+  uint magic;
+  uint seq;
+  uint sum;  // logsum() of the record's blocks
   int n;
   int block[LOGSIZE];
 };
 
+// Contents of the header block.
+struct logtail {
+  uint pos;
+  uint seq;
+};
+
+// Newest committed copy of a block in the journal.
+struct ckpt {
+  struct buf *copy;  // private buffer, blockno is the home location
+  struct buf *pin;   // the block in the cache, pinned until checkpointed
+};
+
 struct log {
   struct spinlock lock;
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int closing;     // logthread() is closing the transaction, please wait.
+  int force;       // somebody wants the transaction committed now.
+  uint opened;     // ticks when the open transaction got its first block
+  uint nclosed;    // transactions closed so far
+  uint ncommitted; // transactions committed so far
   int dev;
-  struct logheader lh;
+  struct logheader lh;         // the open transaction
+  struct buf *pin[LOGSIZE];    // its blocks, pinned in the cache
+
+  // Owned by logthread().
+  uint tail;       // journal position of the oldest record
+  uint head;       // where the next record goes
+  uint seq;        // sequence number of the next record
+  uint idle;       // ticks when the last record was written
+  int nckpt;
+  struct ckpt ckpt[LOGBLOCKS];
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void logthread(void);
 
 void
 initlog(int dev)
@@ -63,62 +117,87 @@ initlog(int dev)
   log.size = sb.nlog;
   log.dev = dev;
   recover_from_log();
+  kthread("logcommit", logthread);
 }
 
-// Copy committed blocks from log to their home location
-static void
-install_trans(void)
+// Block number of journal position pos.
+static uint
+logblock(uint pos)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
-  }
+  return log.start + 1 + pos % (log.size - 1);
 }
 
-// Read the log header from disk into the in-memory log header
-static void
-read_head(void)
+// Checksum of n blocks (FNV-1a), seeded with seq so that an old
+// record left in the ring doesn't match a new descriptor.
+static uint
+logsum(uint seq, uchar **data, int n)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
-  }
-  brelse(buf);
+  uint sum;
+  int i, j;
+
+  sum = 2166136261 ^ seq;
+  for(i = 0; i < n; i++)
+    for(j = 0; j < BSIZE; j++)
+      sum = (sum ^ data[i][j]) * 16777619;
+  return sum;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
 static void
-write_head(void)
+write_tail(void)
 {
   struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+  struct logtail *lt = (struct logtail *) (buf->data);
+  lt->pos = log.tail % (log.size - 1);
+  lt->seq = log.seq;
   bwrite(buf);
   brelse(buf);
 }
 
+// Replay the committed records from the tail onwards,
+// then start an empty journal after them.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct buf *buf, *lbuf[LOGSIZE], *dbuf[LOGSIZE];
+  uchar *data[LOGSIZE];
+  struct logheader lh;
+  int i;
+
+  buf = bread(log.dev, log.start);
+  log.tail = ((struct logtail *) (buf->data))->pos;
+  log.seq = ((struct logtail *) (buf->data))->seq;
+  brelse(buf);
+
+  log.head = log.tail;
+  for(;;){
+    buf = bread(log.dev, logblock(log.head));
+    memmove(&lh, buf->data, sizeof(lh));
+    brelse(buf);
+    if(lh.magic != LOGMAGIC || lh.seq != log.seq ||
+       lh.n < 0 || lh.n > LOGSIZE || lh.n + 1 > log.size - 1)
+      break;
+    for(i = 0; i < lh.n; i++){
+      lbuf[i] = bread(log.dev, logblock(log.head+1+i)); // read log block
+      data[i] = lbuf[i]->data;
+    }
+    if(logsum(lh.seq, data, lh.n) != lh.sum){
+      for(i = 0; i < lh.n; i++)
+        brelse(lbuf[i]);
+      break;
+    }
+    for(i = 0; i < lh.n; i++){
+      dbuf[i] = bread(log.dev, lh.block[i]); // read dst
+      memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+      brelse(lbuf[i]);
+    }
+    bwritev(dbuf, lh.n);  // write dsts to disk
+    for(i = 0; i < lh.n; i++)
+      brelse(dbuf[i]);
+    log.head += lh.n + 1;
+    log.seq++;
+  }
+  log.tail = log.head;
+  write_tail(); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -127,10 +206,12 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
+      log.force = 1;
+      wakeup(&ticks);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -141,69 +222,178 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// The commit happens later, in logthread().
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  // begin_op() may be waiting for log space, and logthread()
+  // for the transaction to quiesce; decrementing
+  // log.outstanding helps both.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Commit everything logged so far and wait until it is on disk.
+void
+logflush(void)
+{
+  uint want;
+
+  acquire(&log.lock);
+  want = log.nclosed + (log.lh.n > 0);
+  while(log.ncommitted < want){
+    log.force = 1;
+    wakeup(&ticks);
+    sleep(&log, &log.lock);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Write every block in the journal to its home location,
+// then empty the journal.
+static void
+checkpoint(void)
+{
+  static struct buf *b[LOGBLOCKS];
+  int i;
+
+  for(i = 0; i < log.nckpt; i++)
+    b[i] = log.ckpt[i].copy;
+  bwritev(b, log.nckpt);
+  log.tail = log.head;
+  write_tail();
+
+  // The home locations are up to date, so the cached
+  // blocks may be evicted again.
+  for(i = 0; i < log.nckpt; i++){
+    bprivfree(log.ckpt[i].copy);
+    bunpin(log.ckpt[i].pin);
   }
+  log.nckpt = 0;
 }
 
-// Copy modified blocks from cache to log.
+// Write a closed transaction: the copies in b[] of the blocks
+// listed in h, whose cached blocks are pinned by pin[], go to
+// the journal, then the descriptor commits them.
 static void
-write_log(void)
+commit(struct logheader *h, struct buf **b, struct buf **pin)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  static uchar *data[LOGSIZE];
+  struct buf *d;
+  struct ckpt *c;
+  int i;
+
+  if(log.head + h->n + 1 - log.tail > log.size - 1)
+    checkpoint();
+
+  for (i = 0; i < h->n; i++) {
+    b[i]->blockno = logblock(log.head+1+i);
+    data[i] = b[i]->data;
+  }
+  bwritev(b, h->n);  // Write the copies to the log
+
+  h->magic = LOGMAGIC;
+  h->seq = log.seq;
+  h->sum = logsum(h->seq, data, h->n);
+  d = bprivate(log.dev, logblock(log.head));
+  memset(d->data, 0, BSIZE);
+  memmove(d->data, h, sizeof(*h));
+  bwrite(d);         // Write descriptor to disk -- the real commit
+  bprivfree(d);
+  log.head += h->n + 1;
+  log.seq++;
+  log.idle = ticks;
+
+  // Keep the newest copy of each block for the checkpoint.
+  for (i = 0; i < h->n; i++) {
+    b[i]->blockno = h->block[i];
+    for (c = log.ckpt; c < &log.ckpt[log.nckpt]; c++)
+      if (c->copy->blockno == h->block[i])  // absorb
+        break;
+    if (c < &log.ckpt[log.nckpt]) {
+      bprivfree(c->copy);
+      bunpin(pin[i]);
+    } else {
+      log.nckpt++;
+      c->pin = pin[i];
+    }
+    c->copy = b[i];
   }
 }
 
+// Is the open transaction due to be committed?
+// Caller holds log.lock.
+static int
+due(void)
+{
+  return log.lh.n > 0 &&
+    (log.force || ticks - log.opened >= COMMITTICKS ||
+     log.lh.n + MAXOPBLOCKS > LOGSIZE);
+}
+
+// The commit thread.
 static void
-commit()
+logthread(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+  static struct logheader h;
+  static struct buf *copy[LOGSIZE], *pin[LOGSIZE];
+  struct buf *b;
+  int i;
+
+  acquire(&log.lock);
+  for(;;){
+    // Wait for a transaction to commit, checking every tick.
+    // Checkpoint when the file system has been idle a while.
+    while(!due()){
+      log.force = 0;
+      release(&log.lock);
+      if(log.nckpt > 0 && ticks - log.idle >= CKPTTICKS)
+        checkpoint();
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+      acquire(&log.lock);
+    }
+
+    // Close the transaction: keep new ops out and wait
+    // for the running ones to finish.
+    log.closing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    h = log.lh;
+    memmove(pin, log.pin, sizeof(pin));
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.force = 0;
+    log.nclosed++;
+    release(&log.lock);
+
+    // Copy the blocks. They are cached and pinned, so
+    // this does no I/O; new ops may then change them.
+    for(i = 0; i < h.n; i++){
+      copy[i] = bprivate(log.dev, h.block[i]);
+      b = bread(log.dev, h.block[i]);
+      memmove(copy[i]->data, b->data, BSIZE);
+      brelse(b);
+    }
+
+    acquire(&log.lock);
+    log.closing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    commit(&h, copy, pin);
+
+    acquire(&log.lock);
+    log.ncommitted++;
+    wakeup(&log);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// Record the block number and pin it in the cache.
+// logthread() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,7 +405,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= LOGSIZE || log.lh.n + 1 >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -225,10 +415,13 @@ log_write(struct buf *b)
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
+    if (i == 0)
+      log.opened = ticks;
+    log.lh.block[i] = b->blockno;
+    log.pin[i] = b;
+    bpin(b);  // prevent eviction
     log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
+  }
   release(&log.lock);
 }
-
@@ -1,11 +1,14 @@
 // Memory layout
 
 #define EXTMEM  0x100000            // Start of extended memory
-#define PHYSTOP 0xE000000           // Top physical memory
+#define PHYSTOP 0xE000000           // Top physical memory if the BIOS doesn't say
+#define E820MAP 0x500               // BIOS memory map saved by bootasm.S
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
+#define PHYSMAX (DEVSPACE-KERNBASE) // Most physical memory the kernel can map
+#define MMAPTOP KERNBASE            // mmap() places regions below this
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
 
 #define V2P(a) (((uint) (a)) - KERNBASE)
@@ -0,0 +1,9 @@
+// Protection and flags for mmap().
+#define PROT_READ     0x1   // pages may be read (required)
+#define PROT_WRITE    0x2   // pages may be written
+
+#define MAP_SHARED    0x01  // writes go to the file and are seen by others
+#define MAP_PRIVATE   0x02  // writes make private copies
+#define MAP_ANONYMOUS 0x20  // zeroed memory, no file
+
+#define MAP_FAILED    ((void*)-1)
@@ -83,6 +83,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define PTSIZE          (PGSIZE*NPTENTRIES) // bytes mapped by a 4MB (PTE_PS) page
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
@@ -94,7 +95,14 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_COW         0x800   // Copy-on-write (available to software)
+
+// Page fault error code bits (tf->err for T_PGFLT)
+#define FEC_PR          0x1     // Fault on a present page (protection)
+#define FEC_WR          0x2     // Fault was a write
+#define FEC_U           0x4     // Fault happened in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
@@ -2,13 +2,17 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // least i-nodes kept cached, more if in use
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGBLOCKS    (LOGSIZE*4)  // size of on-disk log, a ring of transactions
+#define COMMITTICKS   2  // how long a log transaction stays open
+#define CKPTTICKS   100  // idle time before the log is checkpointed
+#define NBUF         (LOGBLOCKS*2)  // minimum size of disk block cache
+#define FSSIZE       2000  // size of file system in blocks
+#define NVMA         16  // file-backed memory regions per process
+#define NPCACHE     256  // pages in the page cache
 
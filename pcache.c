@@ -0,0 +1,209 @@
+// Page cache.
+//
+// Keeps whole pages of file data in memory, keyed by inode and
+// byte offset, so that every process running a program can map
+// the same physical pages for its text and initialized data
+// instead of reading them from disk again (see pgfault() in vm.c).
+// The cache holds one reference (kref) on every page it keeps.
+// Pages that are mapped somewhere have more references and are
+// never evicted; when the cache is full an unmapped page is freed
+// to make room. Writing a file with write() updates its cached
+// pages in place, so that shared mappings (mmap with MAP_SHARED)
+// see the new data; truncating it drops its pages. Shared mappings
+// write to the cached pages and are written back with pcachewrite().
+//
+// Offsets need not be page aligned: the ELF loader maps segments
+// at the file offset given in the program header.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCHASH 61
+
+struct cpage {
+  struct inode *ip;    // 0 if the slot is free
+  uint off;            // File offset of the page's first byte
+  char *page;
+  struct cpage *next;  // Hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  struct cpage *hash[NPCHASH];
+  int hand;            // Next slot to consider for eviction
+} pcache;
+
+#define PCHASH(ip, off) ((((uint)(ip) >> 6) ^ ((off) / PGSIZE) ^ (off)) % NPCHASH)
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+static struct cpage*
+lookup(struct inode *ip, uint off)
+{
+  struct cpage *c;
+
+  for(c = pcache.hash[PCHASH(ip, off)]; c; c = c->next)
+    if(c->ip == ip && c->off == off)
+      return c;
+  return 0;
+}
+
+// Remove c from the cache and drop the cache's reference
+// on its page. Caller holds pcache.lock.
+static void
+evict(struct cpage *c)
+{
+  struct cpage **pp;
+
+  for(pp = &pcache.hash[PCHASH(c->ip, c->off)]; *pp != c; pp = &(*pp)->next)
+    ;
+  *pp = c->next;
+  c->ip->npages--;
+  c->ip = 0;
+  kfree(c->page);
+}
+
+// Find a free slot, evicting a page that no process maps
+// if necessary. Returns 0 if every cached page is in use.
+static struct cpage*
+allocslot(void)
+{
+  struct cpage *c;
+  int i;
+
+  for(i = 0; i < NPCACHE; i++){
+    c = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(c->ip == 0)
+      return c;
+    if(krefcount(c->page) == 1){
+      evict(c);
+      return c;
+    }
+  }
+  return 0;
+}
+
+// Return the cached page of ip at off with a new reference
+// for the caller, or 0 if it is not cached. Never sleeps.
+char*
+pcacheget(struct inode *ip, uint off)
+{
+  struct cpage *c;
+  char *page;
+
+  page = 0;
+  acquire(&pcache.lock);
+  if((c = lookup(ip, off)) != 0){
+    page = c->page;
+    kref(page);
+  }
+  release(&pcache.lock);
+  return page;
+}
+
+// Like pcacheget, but read the page from ip on a miss.
+// Bytes past the end of the file read as zero.
+// Caller must hold ip->lock. Returns 0 if out of memory.
+char*
+pcacheread(struct inode *ip, uint off)
+{
+  struct cpage *c;
+  char *page;
+  int n;
+
+  if((page = pcacheget(ip, off)) != 0)
+    return page;
+  if((page = kalloc()) == 0)
+    return 0;
+  if((n = readi(ip, page, off, PGSIZE)) < 0)
+    n = 0;
+  memset(page + n, 0, PGSIZE - n);
+
+  // Misses are filled under ip->lock, so nobody can have
+  // inserted the same page meanwhile. If the cache is full
+  // the caller just gets a private page.
+  acquire(&pcache.lock);
+  if((c = allocslot()) != 0){
+    c->ip = ip;
+    c->off = off;
+    c->page = page;
+    c->next = pcache.hash[PCHASH(ip, off)];
+    pcache.hash[PCHASH(ip, off)] = c;
+    ip->npages++;
+    kref(page);
+  }
+  release(&pcache.lock);
+  return page;
+}
+
+// Write page back to ip at off, without extending the file.
+// The cached copy, if any, stays: page usually is that copy,
+// modified through a shared mapping. A page is PGSIZE/BSIZE
+// blocks that already exist, which fits in one transaction.
+void
+pcachewrite(struct inode *ip, uint off, char *page)
+{
+  uint n;
+
+  begin_op();
+  ilock(ip);
+  if(off < ip->size){
+    n = ip->size - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    writei(ip, page, off, n);
+  }
+  iunlock(ip);
+  end_op();
+}
+
+// Copy n bytes at src, just written to ip at off, into the
+// cached pages of ip that hold that part of the file. src must
+// be kernel memory. Caller must hold ip->lock.
+void
+pcacheupdate(struct inode *ip, uint off, char *src, uint n)
+{
+  struct cpage *c;
+  uint lo, hi;
+
+  if(ip->npages == 0)
+    return;
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->ip != ip || c->off >= off + n || c->off + PGSIZE <= off)
+      continue;
+    lo = c->off > off ? c->off : off;
+    hi = c->off + PGSIZE < off + n ? c->off + PGSIZE : off + n;
+    memmove(c->page + (lo - c->off), src + (lo - off), hi - lo);
+  }
+  release(&pcache.lock);
+}
+
+// Drop all cached pages of ip, because its contents changed
+// or its in-memory inode is being reused for another file.
+// Processes that map the old pages keep their copies.
+void
+pcachedrop(struct inode *ip)
+{
+  struct cpage *c;
+
+  if(ip->npages == 0)
+    return;
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE] && ip->npages > 0; c++)
+    if(c->ip == ip)
+      evict(c);
+  release(&pcache.lock);
+}
@@ -0,0 +1,102 @@
+// Minimal PCI support: find devices on bus 0 through
+// configuration mechanism #1 (ports 0xCF8 and 0xCFC).
+// The BIOS has already assigned addresses and interrupt
+// lines, so drivers just read them. QEMU puts all its
+// devices on bus 0.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define CONFADDR  0xCF8
+#define CONFDATA  0xCFC
+
+#define PCI_NDEV  32
+#define NFUNC     8
+
+uint
+pciread(struct pcidev *d, uint off)
+{
+  outl(CONFADDR, 0x80000000 | (d->bus << 16) | (d->dev << 11) |
+       (d->func << 8) | (off & 0xfc));
+  return inl(CONFDATA);
+}
+
+void
+pciwrite(struct pcidev *d, uint off, uint v)
+{
+  outl(CONFADDR, 0x80000000 | (d->bus << 16) | (d->dev << 11) |
+       (d->func << 8) | (off & 0xfc));
+  outl(CONFDATA, v);
+}
+
+// Fill in d for the device at d->bus/dev/func.
+// Returns 0 if there is no device there.
+static int
+pciload(struct pcidev *d)
+{
+  uint id, class;
+  int i;
+
+  id = pciread(d, 0x00);
+  if((id & 0xffff) == 0xffff)
+    return 0;
+  d->vendor = id & 0xffff;
+  d->device = id >> 16;
+  class = pciread(d, 0x08);
+  d->class = class >> 24;
+  d->subclass = (class >> 16) & 0xff;
+  for(i = 0; i < 6; i++)
+    d->bar[i] = pciread(d, 0x10 + 4*i);
+  d->irq = pciread(d, 0x3c) & 0xff;
+  return 1;
+}
+
+// Find the first device for which match returns 1,
+// and fill in d. Returns 0 if there is none.
+static int
+pcifind(struct pcidev *d, int (*match)(struct pcidev*, uint, uint),
+        uint a, uint b)
+{
+  d->bus = 0;
+  for(d->dev = 0; d->dev < PCI_NDEV; d->dev++)
+    for(d->func = 0; d->func < NFUNC; d->func++)
+      if(pciload(d) && match(d, a, b))
+        return 1;
+  return 0;
+}
+
+static int
+matchid(struct pcidev *d, uint vendor, uint device)
+{
+  return d->vendor == vendor && d->device == device;
+}
+
+static int
+matchclass(struct pcidev *d, uint class, uint subclass)
+{
+  return d->class == class && d->subclass == subclass;
+}
+
+int
+pcifindid(ushort vendor, ushort device, struct pcidev *d)
+{
+  return pcifind(d, matchid, vendor, device);
+}
+
+int
+pcifindclass(uchar class, uchar subclass, struct pcidev *d)
+{
+  return pcifind(d, matchclass, class, subclass);
+}
+
+// Let d respond to I/O and memory accesses and do DMA.
+void
+pcienable(struct pcidev *d)
+{
+  uint cmd;
+
+  cmd = pciread(d, 0x04) & 0xffff;
+  pciwrite(d, 0x04, cmd | PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
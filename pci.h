@@ -0,0 +1,19 @@
+// PCI configuration space. See pci.c.
+
+struct pcidev {
+  uint bus, dev, func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uint bar[6];       // base address registers, as read
+  uint irq;          // interrupt line assigned by the BIOS
+};
+
+#define PCI_BAR_IO    0x1           // BAR is an I/O port range
+#define PCI_BAR_IOADDR(bar) ((bar) & ~0x3)
+
+// Bits of the command register.
+#define PCI_CMD_IO      0x1
+#define PCI_CMD_MEM     0x2
+#define PCI_CMD_MASTER  0x4         // device may do DMA
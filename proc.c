@@ -6,20 +6,15 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "rbtree.h"
+#include "spawn.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
 } ptable;
 
-struct redBlackTree{
-  struct proc *root;         // Root node
-  struct proc *min_vruntime; // Node wih minimum vruntime for O(1) access
-  struct spinlock lock;      // Spinlock for the tree
-  int count;                 // Total amount of nodes in rbtree
-  int rbTreeWeight;          // Total sum of node weights
-  int period;                // Scheduler period
-} rbtree;
+struct redBlackTree rbtree;
 
 static int min_granularity = 40; // Minimum time a task is allowed to run, tunable
 static int sched_latency = 40*8; // Must be multiple of min_granularity, tunable
@@ -33,351 +28,7 @@ extern void trapret(void);
 static void wakeup1(void *chan);
 
 // --------------------------------------------
-// Red Black Tree functions
-
-struct proc*
-retriveGrandparent(struct proc *node)
-{
-  if (node != NULL && node->rbparent != NULL)
-    return node->rbparent->rbparent;
-  else
-    return NULL; // There's no grandparent if node doesn't exist or its parent doesn't exist.
-}
-
-struct proc*
-retriveUncle(struct proc *node)
-{
-  struct proc *grandparent = retriveGrandparent(node);
-  if (grandparent == NULL)
-    return NULL; // No uncle if there's no grandparent.
-
-  if (node->rbparent == grandparent->left)
-    return grandparent->right;
-  else
-    return grandparent->left;
-}
-
-struct proc*
-retriveMinimum(struct proc *node)
-{
-  if (node == NULL)
-    return NULL;
-
-  while (node->left != NULL)
-    node = node->left;
-
-  return node;
-}
-
-void
-rotateLeft(struct redBlackTree *tree, struct proc *node)
-{
-  if (node == NULL)
-    return;
-
-  struct proc *rightChild = node->right;
-  if (rightChild == NULL)
-    return;
-
-  node->right = rightChild->left;
-  if (rightChild->left != NULL)
-    rightChild->left->rbparent = node;
-
-  rightChild->rbparent = node->rbparent;
-  if (node->rbparent == NULL)
-    tree->root = rightChild;
-  else if (node == node->rbparent->left)
-    node->rbparent->left = rightChild;
-  else
-    node->rbparent->right = rightChild;
-
-  rightChild->left = node;
-  node->rbparent = rightChild;
-}
-
-void
-rotateRight(struct redBlackTree *tree, struct proc *node)
-{
-  if (node == NULL)
-    return;
-
-  struct proc *leftChild = node->left;
-  if (leftChild == NULL)
-    return;
-
-  node->left = leftChild->right;
-  if (leftChild->right != NULL)
-    leftChild->right->rbparent = node;
-
-  leftChild->rbparent = node->rbparent;
-  if (node->rbparent == NULL)
-    tree->root = leftChild;
-  else if (node == node->rbparent->right)
-    node->rbparent->right = leftChild;
-  else
-    node->rbparent->left = leftChild;
-
-  leftChild->right = node;
-  node->rbparent = leftChild;
-}
-
-// u must not be null!
-void
-rbtransplant(struct redBlackTree *tree, struct proc *u, struct proc *v)
-{
-  if (u->rbparent == NULL)
-    tree->root = v;
-  else if (u == u->rbparent->left)
-    u->rbparent->left = v;
-  else
-    u->rbparent->right = v;
-
-  if (v != NULL)
-    v->rbparent = u->rbparent;
-}
-
-void
-rbinsertFixup(struct redBlackTree *tree, struct proc *node)
-{
-  struct proc *parent, *grandparent, *uncle;
-
-  while (node->rbparent != NULL && node->rbparent->color == RED) {
-    parent = node->rbparent;
-    grandparent = retriveGrandparent(node);
-
-    if (parent == grandparent->left) {
-      uncle = grandparent->right;
-
-      if (uncle != NULL && uncle->color == RED) {
-        parent->color = BLACK;
-        uncle->color = BLACK;
-        grandparent->color = RED;
-        node = grandparent;
-      } else {
-        if (node == parent->right) {
-          rotateLeft(tree, parent);
-          node = parent;
-          parent = node->rbparent;
-        }
-
-        rotateRight(tree, grandparent);
-        enum procColor temp = parent->color;
-        parent->color = grandparent->color;
-        grandparent->color = temp;
-        node = parent;
-      }
-    } else {
-      // Symmetric case when the parent is a right child of the grandparent
-      uncle = grandparent->left;
-
-      if (uncle != NULL && uncle->color == RED) {
-        parent->color = BLACK;
-        uncle->color = BLACK;
-        grandparent->color = RED;
-        node = grandparent;
-      } else {
-        if (node == parent->left) {
-          rotateRight(tree, parent);
-          node = parent;
-          parent = node->rbparent;
-        }
-
-        rotateLeft(tree, grandparent);
-        enum procColor temp = parent->color;
-        parent->color = grandparent->color;
-        grandparent->color = temp;
-        node = parent;
-      }
-    }
-  }
-  if (tree->root != NULL)
-    tree->root->color = BLACK;
-}
-
-void
-rbinsert(struct redBlackTree *tree, struct proc *node) {
-  struct proc *current = tree->root;
-  struct proc *parent = NULL;
-
-  // Traverse the tree to find the appropriate position for insertion
-  while (current != NULL) {
-    parent = current;
-    if (node->vruntime < current->vruntime)
-      current = current->left;
-    else
-      current = current->right;
-  }
-
-  // Set the parent for the new node
-  node->rbparent = parent;
-
-  // Set the appropriate child of the parent to the new node
-  if (parent == NULL)
-    tree->root = node; // Inserting the first node
-  else if (node->vruntime < parent->vruntime)
-    parent->left = node;
-  else
-    parent->right = node;
-
-  node->left = NULL;
-  node->right = NULL;
-  node->color = RED; // New nodes are always RED in insertion
-
-  // Fix any violations of the red-black tree properties
-  rbinsertFixup(tree, node);
-
-  // Update the tree CFS properties
-  tree->rbTreeWeight += node->weightValue;
-  tree->count++;
-  tree->min_vruntime = retriveMinimum(tree->root);
-}
-
-void
-rbdeleteFixup(struct redBlackTree *tree, struct proc *node, struct proc *nodeParent) {
-  struct proc *sibling, *parent;
-  parent = nodeParent;
-
-  while (node != tree->root && (node == NULL || node->color == BLACK)) {
-    if (node == parent->left) {
-      sibling = parent->right;
-      if (sibling == NULL)
-      {
-        node = parent;
-        parent = node->rbparent;
-        continue;
-      }
-
-      if (sibling->color == RED) {
-        sibling->color = BLACK;
-        parent->color = RED;
-        rotateLeft(tree, parent);
-        sibling = parent->right;
-      }
-
-      if (sibling == NULL)
-      {
-        node = parent;
-        parent = node->rbparent;
-        continue;
-      }
-
-      if ((sibling->left == NULL || sibling->left->color == BLACK) &&
-          (sibling->right == NULL || sibling->right->color == BLACK)) {
-        sibling->color = RED;
-        node = parent;
-        parent = node->rbparent;
-      } else {
-        if (sibling->left != NULL && sibling->left->color == RED) {
-          sibling->left->color = parent->color;
-          rotateRight(tree, sibling);
-          rotateLeft(tree, parent);
-        } else {
-          sibling->right->color = sibling->color;
-          sibling->color = parent->color;
-          rotateLeft(tree, parent);
-        }
-        node = tree->root;
-      }
-    } else {
-      sibling = parent->left;
-      if (sibling == NULL)
-      {
-        node = parent;
-        parent = node->rbparent;
-        continue;
-      }
-
-      if (sibling->color == RED) {
-        sibling->color = BLACK;
-        parent->color = RED;
-        rotateRight(tree, parent);
-        sibling = parent->left;
-      }
-
-      if (sibling == NULL)
-      {
-        node = parent;
-        parent = node->rbparent;
-        continue;
-      }
-
-      if ((sibling->left == NULL || sibling->left->color == BLACK) &&
-          (sibling->right == NULL || sibling->right->color == BLACK)) {
-        sibling->color = RED;
-        node = parent;
-        parent = node->rbparent;
-      } else {
-        if (sibling->left != NULL && sibling->left->color == RED) {
-          sibling->left->color = sibling->color;
-          sibling->color = parent->color;
-          rotateRight(tree, parent);
-        } else {
-          sibling->right->color = parent->color;
-          rotateLeft(tree, sibling);
-          rotateRight(tree, parent);
-        }
-        node = tree->root;
-      }
-    }
-  }
-  if (node != NULL)
-    node->color = BLACK;
-}
-
-void
-rbdelete(struct redBlackTree *tree, struct proc *node) {
-  struct proc *temp, *child, *parent;
-  int original_color = node->color;
-
-  if (node->left == NULL) {
-    child = node->right;
-    parent = node->rbparent;
-    rbtransplant(tree, node, node->right);
-  } else if (node->right == NULL) {
-    child = node->left;
-    parent = node->rbparent;
-    rbtransplant(tree, node, node->left);
-  } else {
-    temp = retriveMinimum(node->right);
-    original_color = temp->color;
-    child = temp->right;
-    parent = temp->rbparent;
-
-    if (temp->rbparent != node) {
-      rbtransplant(tree, temp, temp->right);
-      temp->right = node->right;
-      temp->right->rbparent = temp;
-    }
-
-    rbtransplant(tree, node, temp);
-    temp->left = node->left;
-    temp->left->rbparent = temp;
-    temp->color = node->color;
-  }
-
-  if (original_color == RED || (child != NULL && child->color == RED))
-  {
-    if (child != NULL)
-      child->color = BLACK;
-  }
-  else
-    rbdeleteFixup(tree, child, parent);
-
-  // Update the tree CFS properties
-  tree->rbTreeWeight -= node->weightValue;
-  tree->count--;
-  tree->min_vruntime = retriveMinimum(tree->root);
-}
-
-// "Pop" the node with the minimum vruntime out of the tree and return it.
-struct proc*
-rbpopMinimum(struct redBlackTree *tree)
-{
-  struct proc *minNode = tree->min_vruntime;
-  if (minNode != NULL)
-    rbdelete(tree, tree->min_vruntime);
-  return minNode;
-}
+// Red Black Tree functions (see rbtree.c)
 
 // Print tree in order of virtual runtime
 void
@@ -672,18 +323,50 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Start a kernel thread running fn, which must never return.
+// It has no user memory and never returns to user space;
+// its page table only maps the kernel. forkret returns
+// into fn instead of trapret.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("kthread");
+  *(uint*)((char*)p->context + sizeof *p->context) = (uint)fn;
+  p->sz = 0;
+  p->parent = 0;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->cwd = 0;
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  insertproc(&rbtree, p);
+  release(&ptable.lock);
+}
+
+//PAGEBREAK: 32
 // Grow current process's memory by n bytes.
+// Growing only reserves address space: the new pages are
+// allocated and zeroed on first touch, by pgfault() in vm.c.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
   uint sz;
+  struct vma *v;
   struct proc *curproc = myproc();
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n < sz || sz + n >= KERNBASE)
       return -1;
+    // The heap may not grow into an mmap() region.
+    for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+      if((v->flags & VMA_MMAP) && sz + n > v->start)
+        return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -709,7 +392,7 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz, curproc->vma)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
@@ -726,6 +409,7 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  vmadup(np->vma, curproc->vma);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -758,6 +442,115 @@ fork(void)
   return pid;
 }
 
+// Create a new process running the program at path with argv.
+// Unlike fork+exec the caller's memory is never copied: the child's
+// address space is built directly by loadimage(). The child gets
+// the caller's cwd and open files, changed by the nacts file
+// actions in acts. Returns the child's pid, or -1 on failure.
+int
+spawn(char *path, char **argv, struct spawnfd *acts, int nacts)
+{
+  int i, fd, srcfd, pid;
+  struct file *f;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // Start at the program's entry point in user mode.
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  np->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  np->tf->es = np->tf->ds;
+  np->tf->ss = np->tf->ds;
+  np->tf->eflags = FL_IF;
+  if((np->pgdir = loadimage(path, argv, np->vma, &np->sz,
+                            &np->tf->eip, &np->tf->esp)) == 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  for(i = 0; i < nacts; i++){
+    fd = acts[i].fd;
+    srcfd = acts[i].srcfd;
+    if(fd < 0 || fd >= NOFILE)
+      goto bad;
+    switch(acts[i].op){
+    case SPAWN_DUP2:
+      if(srcfd < 0 || srcfd >= NOFILE || (f = np->ofile[srcfd]) == 0)
+        goto bad;
+      if(srcfd == fd)
+        break;
+      filedup(f);
+      if(np->ofile[fd])
+        fileclose(np->ofile[fd]);
+      np->ofile[fd] = f;
+      break;
+    case SPAWN_CLOSE:
+      if(np->ofile[fd]){
+        fileclose(np->ofile[fd]);
+        np->ofile[fd] = 0;
+      }
+      break;
+    default:
+      goto bad;
+    }
+  }
+  np->cwd = idup(curproc->cwd);
+
+  setprocname(np, path);
+  np->parent = curproc;
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  // Make the process runnable.
+  np->state = RUNNABLE;
+  // Nice value of the parent gets copied to the child.
+  np->niceValue = curproc->niceValue;
+  // Insert the process into the tree.
+  if(insertproc(&rbtree, np) < 0){
+    np->state = EMBRYO;
+    release(&ptable.lock);
+    goto bad;
+  }
+
+  release(&ptable.lock);
+
+  return pid;
+
+bad:
+  for(i = 0; i < NOFILE; i++){
+    if(np->ofile[i]){
+      fileclose(np->ofile[i]);
+      np->ofile[i] = 0;
+    }
+  }
+  begin_op();
+  vmarelease(np->vma);
+  if(np->cwd){
+    iput(np->cwd);
+    np->cwd = 0;
+  }
+  end_op();
+  freevm(np->pgdir);
+  kfree(np->kstack);
+  np->kstack = 0;
+  np->pid = 0;
+  np->parent = 0;
+  np->name[0] = 0;
+  np->state = UNUSED;
+  return -1;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -779,8 +572,10 @@ exit(void)
     }
   }
 
+  vmaflush(curproc);
   begin_op();
   iput(curproc->cwd);
+  vmarelease(curproc->vma);
   end_op();
   curproc->cwd = 0;
 
@@ -811,6 +606,7 @@ wait(void)
 {
   struct proc *p;
   int havekids, pid;
+  pde_t *pgdir;
   struct proc *curproc = myproc();
 
   acquire(&ptable.lock);
@@ -826,13 +622,16 @@ wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
+        pgdir = p->pgdir;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
         p->state = UNUSED;
         release(&ptable.lock);
+        // Other CPUs may still have the page table loaded, and
+        // freevm waits for them to drop it: not under ptable.lock.
+        freevm(pgdir);
         return pid;
       }
     }
@@ -881,11 +680,12 @@ scheduler(void)
         // to release ptable.lock and then reacquire it
         // before jumping back to us.
         c->proc = p;
-        switchuvm(p);
+        schedswitchuvm(p);
         p->state = RUNNING;
 
         swtch(&(c->scheduler), p->context);
-        switchkvm();
+        // Keep p's page table loaded: if p runs here again next,
+        // its TLB entries are still good (see schedswitchuvm).
 
         // Process is done running for now.
         // It should have changed its p->state before coming back.
@@ -896,6 +696,9 @@ scheduler(void)
     }
 
     release(&ptable.lock);
+
+    // Nothing is runnable, use the time to zero a free page.
+    kzeroidle();
   }
 }
 
@@ -957,8 +760,8 @@ forkret(void)
     // of a regular process (e.g., they call sleep), and thus cannot
     // be run from main().
     first = 0;
-    iinit(ROOTDEV);
     initlog(ROOTDEV);
+    iinit(ROOTDEV);  // reads the bitmap, so after recovery
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -1145,3 +948,24 @@ ps()
 
   return 0;
 }
+
+// Return the total number of ticks the process with the given pid
+// has run for, including its current unaccounted runtime.
+// Returns -1 if there is no such process.
+int
+getruntime(int pid)
+{
+  struct proc *p;
+  int runtime;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      runtime = p->truntime + p->cruntime;
+      release(&ptable.lock);
+      return runtime;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *volatile pgdir;       // Page table loaded in %cr3
 };
 
 extern struct cpu cpus[NCPU];
@@ -36,6 +37,21 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 enum procColor {RED, BLACK};   // Colors of proc in rbtree
 
+// A range of user memory backed by a file. Its pages are not
+// mapped until first touched, see pgfault() in vm.c.
+struct vma {
+  uint start;                  // First address, page aligned
+  uint end;                    // Page aligned end; 0 if the slot is free
+  struct inode *ip;            // Backing file
+  uint off;                    // File offset of start
+  uint filesz;                 // Bytes of file data; the rest reads as zero
+  int flags;                   // VMA_* below
+};
+
+#define VMA_WRITE  0x1         // Pages may be written
+#define VMA_SHARED 0x2         // Writes go to the shared page, not a copy
+#define VMA_MMAP   0x4         // Made by mmap(), above p->sz
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -50,6 +66,8 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct cpu *lastcpu;         // CPU the process last ran on
+  struct vma vma[NVMA];        // File-backed memory regions
   char name[16];               // Process name (debugging)
 
   int vruntime;                // Virtual runtime to sort red black tree
@@ -70,3 +88,5 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+// followed by a gap and the mmap() regions, which are allocated
+// downwards from MMAPTOP.
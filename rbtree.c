@@ -0,0 +1,356 @@
+// Red black tree of runnable processes, ordered by vruntime.
+//
+// This file only depends on the layout of struct proc, so it is
+// also compiled on the host by rbtreetest.c. Locking is up to the
+// caller (see rbtree.lock in proc.c).
+
+#include "types.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "rbtree.h"
+
+#ifndef NULL
+#define NULL ((void *)0)
+#endif
+
+static struct proc*
+retriveGrandparent(struct proc *node)
+{
+  if (node != NULL && node->rbparent != NULL)
+    return node->rbparent->rbparent;
+  else
+    return NULL; // There's no grandparent if node doesn't exist or its parent doesn't exist.
+}
+
+static struct proc*
+retriveMinimum(struct proc *node)
+{
+  if (node == NULL)
+    return NULL;
+
+  while (node->left != NULL)
+    node = node->left;
+
+  return node;
+}
+
+static void
+rotateLeft(struct redBlackTree *tree, struct proc *node)
+{
+  if (node == NULL)
+    return;
+
+  struct proc *rightChild = node->right;
+  if (rightChild == NULL)
+    return;
+
+  node->right = rightChild->left;
+  if (rightChild->left != NULL)
+    rightChild->left->rbparent = node;
+
+  rightChild->rbparent = node->rbparent;
+  if (node->rbparent == NULL)
+    tree->root = rightChild;
+  else if (node == node->rbparent->left)
+    node->rbparent->left = rightChild;
+  else
+    node->rbparent->right = rightChild;
+
+  rightChild->left = node;
+  node->rbparent = rightChild;
+}
+
+static void
+rotateRight(struct redBlackTree *tree, struct proc *node)
+{
+  if (node == NULL)
+    return;
+
+  struct proc *leftChild = node->left;
+  if (leftChild == NULL)
+    return;
+
+  node->left = leftChild->right;
+  if (leftChild->right != NULL)
+    leftChild->right->rbparent = node;
+
+  leftChild->rbparent = node->rbparent;
+  if (node->rbparent == NULL)
+    tree->root = leftChild;
+  else if (node == node->rbparent->right)
+    node->rbparent->right = leftChild;
+  else
+    node->rbparent->left = leftChild;
+
+  leftChild->right = node;
+  node->rbparent = leftChild;
+}
+
+// u must not be null!
+static void
+rbtransplant(struct redBlackTree *tree, struct proc *u, struct proc *v)
+{
+  if (u->rbparent == NULL)
+    tree->root = v;
+  else if (u == u->rbparent->left)
+    u->rbparent->left = v;
+  else
+    u->rbparent->right = v;
+
+  if (v != NULL)
+    v->rbparent = u->rbparent;
+}
+
+static void
+rbinsertFixup(struct redBlackTree *tree, struct proc *node)
+{
+  struct proc *parent, *grandparent, *uncle;
+
+  // After a rotation node is moved up to a black subtree root,
+  // which ends the loop.
+  while (node->color == RED &&
+         node->rbparent != NULL && node->rbparent->color == RED) {
+    parent = node->rbparent;
+    grandparent = retriveGrandparent(node);
+
+    if (parent == grandparent->left) {
+      uncle = grandparent->right;
+
+      if (uncle != NULL && uncle->color == RED) {
+        parent->color = BLACK;
+        uncle->color = BLACK;
+        grandparent->color = RED;
+        node = grandparent;
+      } else {
+        if (node == parent->right) {
+          rotateLeft(tree, parent);
+          node = parent;
+          parent = node->rbparent;
+        }
+
+        rotateRight(tree, grandparent);
+        enum procColor temp = parent->color;
+        parent->color = grandparent->color;
+        grandparent->color = temp;
+        node = parent;
+      }
+    } else {
+      // Symmetric case when the parent is a right child of the grandparent
+      uncle = grandparent->left;
+
+      if (uncle != NULL && uncle->color == RED) {
+        parent->color = BLACK;
+        uncle->color = BLACK;
+        grandparent->color = RED;
+        node = grandparent;
+      } else {
+        if (node == parent->left) {
+          rotateRight(tree, parent);
+          node = parent;
+          parent = node->rbparent;
+        }
+
+        rotateLeft(tree, grandparent);
+        enum procColor temp = parent->color;
+        parent->color = grandparent->color;
+        grandparent->color = temp;
+        node = parent;
+      }
+    }
+  }
+  if (tree->root != NULL)
+    tree->root->color = BLACK;
+}
+
+void
+rbinsert(struct redBlackTree *tree, struct proc *node) {
+  struct proc *current = tree->root;
+  struct proc *parent = NULL;
+
+  // Traverse the tree to find the appropriate position for insertion
+  while (current != NULL) {
+    parent = current;
+    if (node->vruntime < current->vruntime)
+      current = current->left;
+    else
+      current = current->right;
+  }
+
+  // Set the parent for the new node
+  node->rbparent = parent;
+
+  // Set the appropriate child of the parent to the new node
+  if (parent == NULL)
+    tree->root = node; // Inserting the first node
+  else if (node->vruntime < parent->vruntime)
+    parent->left = node;
+  else
+    parent->right = node;
+
+  node->left = NULL;
+  node->right = NULL;
+  node->color = RED; // New nodes are always RED in insertion
+
+  // Fix any violations of the red-black tree properties
+  rbinsertFixup(tree, node);
+
+  // Update the tree CFS properties
+  tree->rbTreeWeight += node->weightValue;
+  tree->count++;
+  tree->min_vruntime = retriveMinimum(tree->root);
+}
+
+static void
+rbdeleteFixup(struct redBlackTree *tree, struct proc *node, struct proc *nodeParent) {
+  struct proc *sibling, *parent;
+  parent = nodeParent;
+
+  while (node != tree->root && (node == NULL || node->color == BLACK)) {
+    if (node == parent->left) {
+      sibling = parent->right;
+      if (sibling == NULL)
+      {
+        node = parent;
+        parent = node->rbparent;
+        continue;
+      }
+
+      if (sibling->color == RED) {
+        sibling->color = BLACK;
+        parent->color = RED;
+        rotateLeft(tree, parent);
+        sibling = parent->right;
+      }
+
+      if (sibling == NULL)
+      {
+        node = parent;
+        parent = node->rbparent;
+        continue;
+      }
+
+      if ((sibling->left == NULL || sibling->left->color == BLACK) &&
+          (sibling->right == NULL || sibling->right->color == BLACK)) {
+        sibling->color = RED;
+        node = parent;
+        parent = node->rbparent;
+      } else {
+        if (sibling->left != NULL && sibling->left->color == RED) {
+          sibling->left->color = parent->color;
+          parent->color = BLACK;
+          rotateRight(tree, sibling);
+          rotateLeft(tree, parent);
+        } else {
+          sibling->right->color = sibling->color;
+          sibling->color = parent->color;
+          parent->color = BLACK;
+          rotateLeft(tree, parent);
+        }
+        node = tree->root;
+      }
+    } else {
+      sibling = parent->left;
+      if (sibling == NULL)
+      {
+        node = parent;
+        parent = node->rbparent;
+        continue;
+      }
+
+      if (sibling->color == RED) {
+        sibling->color = BLACK;
+        parent->color = RED;
+        rotateRight(tree, parent);
+        sibling = parent->left;
+      }
+
+      if (sibling == NULL)
+      {
+        node = parent;
+        parent = node->rbparent;
+        continue;
+      }
+
+      if ((sibling->left == NULL || sibling->left->color == BLACK) &&
+          (sibling->right == NULL || sibling->right->color == BLACK)) {
+        sibling->color = RED;
+        node = parent;
+        parent = node->rbparent;
+      } else {
+        if (sibling->left != NULL && sibling->left->color == RED) {
+          sibling->left->color = sibling->color;
+          sibling->color = parent->color;
+          parent->color = BLACK;
+          rotateRight(tree, parent);
+        } else {
+          sibling->right->color = parent->color;
+          parent->color = BLACK;
+          rotateLeft(tree, sibling);
+          rotateRight(tree, parent);
+        }
+        node = tree->root;
+      }
+    }
+  }
+  if (node != NULL)
+    node->color = BLACK;
+}
+
+void
+rbdelete(struct redBlackTree *tree, struct proc *node) {
+  struct proc *temp, *child, *parent;
+  int original_color = node->color;
+
+  if (node->left == NULL) {
+    child = node->right;
+    parent = node->rbparent;
+    rbtransplant(tree, node, node->right);
+  } else if (node->right == NULL) {
+    child = node->left;
+    parent = node->rbparent;
+    rbtransplant(tree, node, node->left);
+  } else {
+    temp = retriveMinimum(node->right);
+    original_color = temp->color;
+    child = temp->right;
+    // If temp is node's own right child it takes node's place,
+    // so it becomes the parent of child rather than node.
+    parent = (temp->rbparent == node) ? temp : temp->rbparent;
+
+    if (temp->rbparent != node) {
+      rbtransplant(tree, temp, temp->right);
+      temp->right = node->right;
+      temp->right->rbparent = temp;
+    }
+
+    rbtransplant(tree, node, temp);
+    temp->left = node->left;
+    temp->left->rbparent = temp;
+    temp->color = node->color;
+  }
+
+  if (original_color == RED || (child != NULL && child->color == RED))
+  {
+    if (child != NULL)
+      child->color = BLACK;
+  }
+  else
+    rbdeleteFixup(tree, child, parent);
+
+  // Update the tree CFS properties
+  tree->rbTreeWeight -= node->weightValue;
+  tree->count--;
+  tree->min_vruntime = retriveMinimum(tree->root);
+}
+
+// "Pop" the node with the minimum vruntime out of the tree and return it.
+struct proc*
+rbpopMinimum(struct redBlackTree *tree)
+{
+  struct proc *minNode = tree->min_vruntime;
+  if (minNode != NULL)
+    rbdelete(tree, tree->min_vruntime);
+  return minNode;
+}
@@ -0,0 +1,15 @@
+// Red black tree used as the CFS run queue.
+// Nodes are procs, linked through their left, right and rbparent fields.
+struct redBlackTree{
+  struct proc *root;         // Root node
+  struct proc *min_vruntime; // Node wih minimum vruntime for O(1) access
+  struct spinlock lock;      // Spinlock for the tree
+  int count;                 // Total amount of nodes in rbtree
+  int rbTreeWeight;          // Total sum of node weights
+  int period;                // Scheduler period
+};
+
+// rbtree.c
+void            rbinsert(struct redBlackTree*, struct proc*);
+void            rbdelete(struct redBlackTree*, struct proc*);
+struct proc*    rbpopMinimum(struct redBlackTree*);
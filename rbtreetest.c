@@ -0,0 +1,254 @@
+// Host-side test and microbenchmark for the CFS red black tree.
+// Built and run on the host by "make rbtreetest".
+//
+// Usage: rbtreetest [seed]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "rbtree.h"
+
+#define MAXNODES 100000
+
+struct proc *nodes;
+char *intree;
+int failures;
+
+static uint rngstate = 1;
+
+static uint
+rnd(void)
+{
+  rngstate ^= rngstate << 13;
+  rngstate ^= rngstate >> 17;
+  rngstate ^= rngstate << 5;
+  return rngstate;
+}
+
+static void
+fail(char *what, int op)
+{
+  if(failures++ < 10)
+    fprintf(stderr, "rbtreetest: op %d: %s\n", op, what);
+}
+
+static struct proc *prev;
+
+// Check the subtree at n and return its black height, or -1 on error.
+static int
+checknode(struct redBlackTree *t, struct proc *n, int *count, int *weight, int op)
+{
+  int lh, rh;
+
+  if(n == NULL)
+    return 1;
+  if(n->left != NULL && n->left->rbparent != n)
+    fail("bad parent pointer", op);
+  if(n->right != NULL && n->right->rbparent != n)
+    fail("bad parent pointer", op);
+  if(n->color == RED &&
+     ((n->left != NULL && n->left->color == RED) ||
+      (n->right != NULL && n->right->color == RED)))
+    fail("red node with red child", op);
+  if(!intree[n - nodes])
+    fail("tree contains deleted node", op);
+
+  lh = checknode(t, n->left, count, weight, op);
+  if(prev != NULL && prev->vruntime > n->vruntime)
+    fail("in-order walk is not sorted", op);
+  prev = n;
+  (*count)++;
+  *weight += n->weightValue;
+  rh = checknode(t, n->right, count, weight, op);
+
+  if(lh < 0 || rh < 0)
+    return -1;
+  if(lh != rh){
+    fail("black heights differ", op);
+    return -1;
+  }
+  return lh + (n->color == BLACK);
+}
+
+static void
+checktree(struct redBlackTree *t, int n, int op)
+{
+  int count, weight;
+  struct proc *min;
+
+  count = weight = 0;
+  prev = NULL;
+  if(t->root != NULL && t->root->color != BLACK)
+    fail("root is not black", op);
+  if(t->root != NULL && t->root->rbparent != NULL)
+    fail("root has a parent", op);
+  checknode(t, t->root, &count, &weight, op);
+  if(count != t->count || count != n)
+    fail("node count mismatch", op);
+  if(weight != t->rbTreeWeight)
+    fail("weight sum mismatch", op);
+  for(min = t->root; min != NULL && min->left != NULL; min = min->left)
+    ;
+  if(min != t->min_vruntime)
+    fail("cached minimum is not the leftmost node", op);
+}
+
+static void
+resettree(struct redBlackTree *t)
+{
+  memset(t, 0, sizeof(*t));
+  memset(intree, 0, MAXNODES);
+}
+
+static void
+setnode(struct proc *p, int vruntime)
+{
+  p->vruntime = vruntime;
+  p->weightValue = 15 + rnd() % 1024;
+}
+
+// Random insert/delete/pop sequence over at most n nodes with a small
+// key range, so duplicate vruntimes are common.
+static void
+randomtest(int n, int ops, int checkevery)
+{
+  struct redBlackTree t;
+  struct proc *p;
+  int i, j, size, op, minv;
+
+  resettree(&t);
+  size = 0;
+  for(op = 0; op < ops; op++){
+    i = rnd() % n;
+    switch(rnd() % 3){
+    case 0:
+      if(intree[i])
+        break;
+      setnode(&nodes[i], rnd() % (n / 2 + 1));
+      rbinsert(&t, &nodes[i]);
+      intree[i] = 1;
+      size++;
+      break;
+    case 1:
+      if(!intree[i])
+        break;
+      rbdelete(&t, &nodes[i]);
+      intree[i] = 0;
+      size--;
+      break;
+    case 2:
+      minv = 0x7fffffff;
+      for(j = 0; j < n && size > 0 && checkevery == 1; j++)
+        if(intree[j] && nodes[j].vruntime < minv)
+          minv = nodes[j].vruntime;
+      p = rbpopMinimum(&t);
+      if((p == NULL) != (size == 0)){
+        fail("rbpopMinimum on wrong tree size", op);
+        break;
+      }
+      if(p == NULL)
+        break;
+      if(checkevery == 1 && p->vruntime != minv)
+        fail("rbpopMinimum did not return the minimum", op);
+      intree[p - nodes] = 0;
+      size--;
+      break;
+    }
+    if(op % checkevery == 0)
+      checktree(&t, size, op);
+  }
+  checktree(&t, size, ops);
+
+  // Drain the tree and make sure it comes out sorted.
+  prev = NULL;
+  while((p = rbpopMinimum(&t)) != NULL){
+    if(prev != NULL && prev->vruntime > p->vruntime)
+      fail("drain is not sorted", ops);
+    prev = p;
+    intree[p - nodes] = 0;
+    size--;
+  }
+  if(size != 0 || t.count != 0 || t.root != NULL || t.rbTreeWeight != 0)
+    fail("tree not empty after drain", ops);
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Time the scheduler's access pattern on a tree of n nodes:
+// pop the minimum, charge it some runtime and reinsert it,
+// plus a random delete and reinsert as sleeps and wakeups do.
+static void
+bench(int n)
+{
+  struct redBlackTree t;
+  struct proc *p;
+  int i, iters, ops;
+  double start, dt;
+
+  resettree(&t);
+  for(i = 0; i < n; i++){
+    setnode(&nodes[i], rnd() % (n * 4));
+    rbinsert(&t, &nodes[i]);
+    intree[i] = 1;
+  }
+
+  iters = 2000000 / 4;
+  ops = 0;
+  start = now();
+  for(i = 0; i < iters; i++){
+    p = rbpopMinimum(&t);
+    p->vruntime += 1 + rnd() % 64;
+    rbinsert(&t, p);
+    p = &nodes[rnd() % n];
+    rbdelete(&t, p);
+    rbinsert(&t, p);
+    ops += 4;
+  }
+  dt = now() - start;
+  checktree(&t, n, -1);
+
+  printf("BENCH rbtree n=%d ops_per_sec %.0f\n", n, ops / dt);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static int sizes[] = { 64, 256, 1024, 4096, 16384, 100000 };
+  int i;
+
+  if(argc > 1)
+    rngstate = atoi(argv[1]) ? atoi(argv[1]) : 1;
+  nodes = calloc(MAXNODES, sizeof(struct proc));
+  intree = calloc(MAXNODES, 1);
+  if(nodes == NULL || intree == NULL){
+    fprintf(stderr, "rbtreetest: out of memory\n");
+    return 1;
+  }
+
+  // Full checks after every op on small trees, sampled on big ones.
+  for(i = 0; i < 200; i++)
+    randomtest(1 + i % 64, 2000, 1);
+  randomtest(1000, 200000, 1);
+  randomtest(MAXNODES, 1000000, 50000);
+  printf("CHECK rbtree %s\n", failures ? "FAIL" : "PASS");
+  if(failures)
+    return 1;
+
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+    bench(sizes[i]);
+  return 0;
+}
@@ -0,0 +1,170 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// Fixed workload mix for measuring how the kernel scales with CPUs.
+// "make bench-scaling" boots xv6 with different CPU counts, runs this
+// program in each and builds a table from the BENCH lines:
+//   BENCH <workload> rate <value> ops/100ticks
+// or "CHECK <workload> FAIL" in place of the rate if a worker failed.
+// Every workload runs NWORKER processes in parallel, so with enough
+// CPUs the rate should grow until a shared lock serializes them.
+// Run "scalebench -n" to skip the final halt().
+
+#define NWORKER    8
+#define CPUWORK   40   // busy loop chunks per worker
+#define CHUNK  200000  // iterations per busy loop chunk
+#define FORKS     60   // fork+exit+wait per worker
+#define ROUNDS   500   // pipe round trips per worker
+#define FILES     20   // create/write/unlink per worker
+
+int nfail;
+
+// A worker returns 0 if all its operations succeeded, else -1.
+
+int
+cpuwork(int w)
+{
+  volatile int x;
+  int i, j;
+
+  x = w;
+  for(i = 0; i < CPUWORK; i++)
+    for(j = 0; j < CHUNK; j++)
+      x = x * 3 + j;
+  return 0;
+}
+
+int
+forkwork(int w)
+{
+  int i, pid;
+
+  for(i = 0; i < FORKS; i++){
+    pid = fork();
+    if(pid < 0)
+      return -1;
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  return 0;
+}
+
+int
+pipework(int w)
+{
+  int ping[2], pong[2], i, pid;
+  char c;
+
+  if(pipe(ping) < 0)
+    return -1;
+  if(pipe(pong) < 0 || (pid = fork()) < 0){
+    close(ping[0]);
+    close(ping[1]);
+    return -1;
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit();
+  }
+  close(ping[0]);
+  close(pong[1]);
+  c = w;
+  for(i = 0; i < ROUNDS; i++)
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+      break;
+  close(ping[1]);
+  close(pong[0]);
+  wait();
+  return i == ROUNDS ? 0 : -1;
+}
+
+int
+fswork(int w)
+{
+  char name[8], buf[512];
+  int i, fd, n;
+
+  name[0] = 's';
+  name[1] = 'b';
+  name[2] = '0' + w;
+  name[3] = 0;
+  memset(buf, w, sizeof(buf));
+  for(i = 0; i < FILES; i++){
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+      return -1;
+    n = write(fd, buf, sizeof(buf));
+    close(fd);
+    if(n != sizeof(buf) || unlink(name) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Run fn in NWORKER processes at once and report the combined rate.
+// Each worker reports success with one byte on a pipe; if any
+// worker fails, the rate would be wrong and is not printed.
+void
+run(char *name, int (*fn)(int), int opsperworker)
+{
+  int w, pid, start, dt, n, ok, st[2];
+  char c;
+
+  if(pipe(st) < 0){
+    printf(1, "CHECK %s FAIL\n", name);
+    nfail++;
+    return;
+  }
+  start = uptime();
+  n = 0;
+  for(w = 0; w < NWORKER; w++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      close(st[0]);
+      c = fn(w) == 0;
+      write(st[1], &c, 1);
+      exit();
+    }
+    n++;
+  }
+  close(st[1]);
+  for(w = 0; w < n; w++)
+    wait();
+  dt = uptime() - start;
+  if(dt <= 0)
+    dt = 1;
+  ok = 0;
+  while(read(st[0], &c, 1) == 1)
+    ok += c;
+  close(st[0]);
+  if(n != NWORKER || ok != NWORKER){
+    printf(1, "CHECK %s FAIL\n", name);
+    nfail++;
+    return;
+  }
+  printf(1, "BENCH %s rate %d ops/100ticks\n", name,
+         n * opsperworker * 100 / dt);
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "scalebench starting\n");
+
+  run("cpu", cpuwork, CPUWORK);
+  run("fork", forkwork, FORKS);
+  run("pipe", pipework, 2*ROUNDS);
+  run("fs", fswork, FILES);
+
+  printf(1, "DONE fail %d\n", nfail);
+  if(argc < 2 || strcmp(argv[1], "-n") != 0)
+    halt();
+  exit();
+}
@@ -0,0 +1,351 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "spawn.h"
+
+// Self-checking scheduler benchmark suite.
+//
+// Every result is printed on its own line so the console log can be
+// scraped by scripts:
+//   BENCH <test> <metric> <value> <unit>
+//   CHECK <test> PASS|FAIL
+//   DONE pass <n> fail <m>
+// Rates are measured with uptime() and reported per 100 ticks (about
+// one second of xv6 time), latencies are measured with the TSC.
+// Run "schedbench -n" to skip the final halt(). "schedbench -x"
+// exits at once; the exec tests use it as their child program.
+
+#define CTXROUNDS   2000   // ping-pong round trips
+#define FORKS        500   // fork+exit+wait iterations
+#define EXECS        100   // fork+exec+wait and spawn+wait iterations
+#define WAKESAMPLES   64   // wakeup latency samples per run
+#define NICEHOGS       8   // cpu hogs per nice class
+#define NICETICKS    500   // how long the nice hogs run
+#define NICETOL       25   // accepted error of the nice ratio in percent
+
+// Two nice classes and their weights from prio_to_weight in proc.c.
+#define NICE_HI        0
+#define NICE_LO        5
+#define WEIGHT_HI   1024
+#define WEIGHT_LO    335
+
+int npass, nfail;
+
+static inline uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
+void
+check(char *test, int ok)
+{
+  printf(1, "CHECK %s %s\n", test, ok ? "PASS" : "FAIL");
+  if(ok)
+    npass++;
+  else
+    nfail++;
+}
+
+void
+bench(char *test, char *metric, int value, char *unit)
+{
+  printf(1, "BENCH %s %s %d %s\n", test, metric, value, unit);
+}
+
+// Scale n operations done in dt ticks to operations per 100 ticks.
+int
+rate(int n, int dt)
+{
+  if(dt <= 0)
+    dt = 1;
+  return n * 100 / dt;
+}
+
+void
+cpuhog(void)
+{
+  for(;;)
+    ;
+}
+
+// Fork n cpu hogs at the given nice value, storing their pids.
+int
+spawnhogs(int *pids, int n, int niceval)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    pids[i] = fork();
+    if(pids[i] < 0)
+      return i;
+    if(pids[i] == 0){
+      nice(niceval);
+      cpuhog();
+    }
+  }
+  return n;
+}
+
+void
+killhogs(int *pids, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    kill(pids[i]);
+  for(i = 0; i < n; i++)
+    wait();
+}
+
+// Two processes bounce a byte over a pair of pipes.
+// Every round trip is at least two context switches.
+void
+ctxswitchtest(void)
+{
+  int ping[2], pong[2], i, pid, start, dt, ok;
+  char c;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    check("ctxswitch", 0);
+    return;
+  }
+  pid = fork();
+  if(pid < 0){
+    check("ctxswitch", 0);
+    return;
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit();
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  ok = 1;
+  start = uptime();
+  for(i = 0; i < CTXROUNDS; i++){
+    c = i;
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1 ||
+       c != (char)i){
+      ok = 0;
+      break;
+    }
+  }
+  dt = uptime() - start;
+  close(ping[1]);
+  close(pong[0]);
+  wait();
+
+  bench("ctxswitch", "rate", rate(2*i, dt), "switches/100ticks");
+  check("ctxswitch", ok);
+}
+
+void
+forktest(void)
+{
+  int i, pid, start, dt, ok;
+
+  ok = 1;
+  start = uptime();
+  for(i = 0; i < FORKS; i++){
+    pid = fork();
+    if(pid < 0){
+      ok = 0;
+      break;
+    }
+    if(pid == 0)
+      exit();
+    if(wait() != pid){
+      ok = 0;
+      break;
+    }
+  }
+  dt = uptime() - start;
+
+  bench("fork", "rate", rate(i, dt), "forks/100ticks");
+  check("fork", ok);
+}
+
+char *xargv[] = { "schedbench", "-x", 0 };
+
+// Start a program the way sh.c used to, with fork and exec.
+void
+forkexectest(void)
+{
+  int i, pid, start, dt, ok;
+
+  ok = 1;
+  start = uptime();
+  for(i = 0; i < EXECS; i++){
+    pid = fork();
+    if(pid < 0){
+      ok = 0;
+      break;
+    }
+    if(pid == 0){
+      exec("/schedbench", xargv);
+      exit();
+    }
+    if(wait() != pid){
+      ok = 0;
+      break;
+    }
+  }
+  dt = uptime() - start;
+
+  bench("forkexec", "rate", rate(i, dt), "execs/100ticks");
+  check("forkexec", ok);
+}
+
+// Start the same program with spawn(), as sh.c does now.
+void
+spawntest(void)
+{
+  int i, pid, start, dt, ok;
+
+  ok = 1;
+  start = uptime();
+  for(i = 0; i < EXECS; i++){
+    if((pid = spawn("/schedbench", xargv, 0)) < 0 || wait() != pid){
+      ok = 0;
+      break;
+    }
+  }
+  dt = uptime() - start;
+
+  bench("spawn", "rate", rate(i, dt), "execs/100ticks");
+  check("spawn", ok);
+}
+
+void
+sortsamples(uint *s, int n)
+{
+  int i, j;
+  uint v;
+
+  for(i = 1; i < n; i++){
+    v = s[i];
+    for(j = i; j > 0 && s[j-1] > v; j--)
+      s[j] = s[j-1];
+    s[j] = v;
+  }
+}
+
+// Measure how long a process sleeping in read() takes to run again
+// after the pipe is written. The parent sleeps for a tick between
+// samples so the child is always blocked when the write happens.
+void
+wakeuptest(char *test, int nhogs)
+{
+  int wake[2], back[2], hogs[NICEHOGS], i, n, pid, ok;
+  uint t0, t1, lat[WAKESAMPLES];
+
+  if(pipe(wake) < 0 || pipe(back) < 0){
+    check(test, 0);
+    return;
+  }
+  pid = fork();
+  if(pid < 0){
+    check(test, 0);
+    return;
+  }
+  if(pid == 0){
+    close(wake[1]);
+    close(back[0]);
+    while(read(wake[0], &t0, sizeof(t0)) == sizeof(t0)){
+      t1 = rdtsc();
+      t1 -= t0;
+      write(back[1], &t1, sizeof(t1));
+    }
+    exit();
+  }
+  close(wake[0]);
+  close(back[1]);
+
+  n = spawnhogs(hogs, nhogs, 0);
+  ok = n == nhogs;
+  for(i = 0; ok && i < WAKESAMPLES; i++){
+    sleep(1);
+    t0 = rdtsc();
+    if(write(wake[1], &t0, sizeof(t0)) != sizeof(t0) ||
+       read(back[0], &lat[i], sizeof(lat[i])) != sizeof(lat[i]))
+      ok = 0;
+  }
+  killhogs(hogs, n);
+  close(wake[1]);
+  close(back[0]);
+  wait();
+
+  if(ok){
+    sortsamples(lat, WAKESAMPLES);
+    bench(test, "p50", lat[WAKESAMPLES*50/100], "cycles");
+    bench(test, "p90", lat[WAKESAMPLES*90/100], "cycles");
+    bench(test, "p99", lat[WAKESAMPLES*99/100], "cycles");
+    bench(test, "max", lat[WAKESAMPLES-1], "cycles");
+  }
+  check(test, ok);
+}
+
+// Run two classes of cpu hogs with different nice values and compare
+// the cpu time they received against the ratio of their weights.
+// There are more hogs than CPUs, so the scheduler has to share.
+void
+nicetest(void)
+{
+  int hi[NICEHOGS], lo[NICEHOGS], nhi, nlo, i, t, sumhi, sumlo;
+  int want, got, err, ok;
+
+  nhi = spawnhogs(hi, NICEHOGS, NICE_HI);
+  nlo = spawnhogs(lo, NICEHOGS, NICE_LO);
+  ok = nhi == NICEHOGS && nlo == NICEHOGS;
+
+  sleep(NICETICKS);
+
+  sumhi = sumlo = 0;
+  for(i = 0; i < nhi; i++)
+    if((t = getruntime(hi[i])) > 0)
+      sumhi += t;
+  for(i = 0; i < nlo; i++)
+    if((t = getruntime(lo[i])) > 0)
+      sumlo += t;
+  killhogs(hi, nhi);
+  killhogs(lo, nlo);
+
+  // Ratios are fixed point with two decimals.
+  want = WEIGHT_HI * 100 / WEIGHT_LO;
+  got = sumlo > 0 ? sumhi * 100 / sumlo : 0;
+  err = got > want ? got - want : want - got;
+  bench("nice", "expected", want, "ratio*100");
+  bench("nice", "measured", got, "ratio*100");
+  bench("nice", "error", err * 100 / want, "percent");
+  check("nice", ok && err * 100 <= want * NICETOL);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit();
+
+  printf(1, "schedbench starting\n");
+
+  ctxswitchtest();
+  forktest();
+  forkexectest();
+  spawntest();
+  wakeuptest("wakeup-idle", 0);
+  wakeuptest("wakeup-loaded", NICEHOGS);
+  nicetest();
+
+  printf(1, "DONE pass %d fail %d\n", npass, nfail);
+  if(argc < 2 || strcmp(argv[1], "-n") != 0)
+    halt();
+  exit();
+}
@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,8 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+int parseerr;     // Set when the last parsecmd found a syntax error.
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +133,71 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Start one simple command with spawn(), applying the file
+// actions fa. Returns the number of children started.
+int
+spawnexec(struct execcmd *ecmd, struct spawnfd *fa)
+{
+  if(ecmd->argv[0] == 0)
+    return 0;
+  if(spawn(ecmd->argv[0], ecmd->argv, fa) < 0){
+    printf(2, "exec %s failed\n", ecmd->argv[0]);
+    return 0;
+  }
+  return 1;
+}
+
+// Run cmd without forking the shell if it is a simple command,
+// a simple command with one redirection, or a pipe between two
+// simple commands. Returns the number of children to wait for,
+// or -1 if cmd has to go through fork and runcmd.
+int
+spawncmd(struct cmd *cmd)
+{
+  int p[2], fd, n;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+  struct spawnfd fa[4];
+
+  switch(cmd->type){
+  case EXEC:
+    return spawnexec((struct execcmd*)cmd, 0);
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if(rcmd->cmd->type != EXEC)
+      return -1;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    fa[0] = (struct spawnfd){ SPAWN_DUP2, rcmd->fd, fd };
+    fa[1] = (struct spawnfd){ SPAWN_CLOSE, fd, 0 };
+    fa[2] = (struct spawnfd){ SPAWN_END, 0, 0 };
+    n = spawnexec((struct execcmd*)rcmd->cmd, fa);
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pcmd->left->type != EXEC || pcmd->right->type != EXEC)
+      return -1;
+    if(pipe(p) < 0)
+      return -1;
+    fa[1] = (struct spawnfd){ SPAWN_CLOSE, p[0], 0 };
+    fa[2] = (struct spawnfd){ SPAWN_CLOSE, p[1], 0 };
+    fa[3] = (struct spawnfd){ SPAWN_END, 0, 0 };
+    fa[0] = (struct spawnfd){ SPAWN_DUP2, 1, p[1] };
+    n = spawnexec((struct execcmd*)pcmd->left, fa);
+    fa[0] = (struct spawnfd){ SPAWN_DUP2, 0, p[0] };
+    n += spawnexec((struct execcmd*)pcmd->right, fa);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  return -1;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +213,8 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, n;
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +233,22 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    // Parse in the shell itself, so that simple commands can be
+    // started with spawn() instead of a fork of the whole shell.
+    cmd = parsecmd(buf);
+    if(parseerr){
+      parseerr = 0;
+      freecmd(cmd);
+      continue;
+    }
+    if((n = spawncmd(cmd)) < 0){
+      if(fork1() == 0)
+        runcmd(cmd);
+      n = 1;
+    }
+    while(n-- > 0)
+      wait();
+    freecmd(cmd);
   }
   exit();
 }
@@ -256,9 +338,44 @@ backcmd(struct cmd *subcmd)
   cmd->cmd = subcmd;
   return (struct cmd*)cmd;
 }
+
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
 //PAGEBREAK!
 // Parsing
 
+// Report a syntax error. The shell parses commands itself, so
+// this must not exit; parsecmd's caller checks parseerr.
+void
+syntax(char *s)
+{
+  if(!parseerr)
+    printf(2, "%s\n", s);
+  parseerr = 1;
+}
+
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
 
@@ -333,9 +450,9 @@ parsecmd(char *s)
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +496,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +524,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +552,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc+1 >= MAXARGS){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
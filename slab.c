@@ -0,0 +1,188 @@
+// Slab allocator for kernel objects smaller than a page,
+// like pipes, open files, inodes and buffers.
+//
+// A cache hands out objects of one size. It carves whole
+// pages from kalloc() into slabs: a small header followed by
+// as many objects as fit. Objects are constructed once, when
+// their slab is created, and must be freed in constructed
+// state (e.g. with the lock released), so allocation doesn't
+// have to initialize them again. A free object's link to the
+// next one lives in a word after the object, so that it does
+// not overwrite constructed state.
+//
+// Each CPU keeps a stack of up to SLABMAG free objects, moved
+// to and from the slabs in batches, so that most allocations
+// and frees touch only per-CPU state.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+#define SLABBATCH (SLABMAG/2)
+
+// Header at the start of each slab page.
+struct slab {
+  struct slab *next;         // Partial list
+  struct slab *prev;
+  struct slabcache *cache;
+  void *free;                // Free objects in this slab
+  uint inuse;                // Objects handed out
+};
+
+#define OBJALIGN 8
+#define SLABHDR ((sizeof(struct slab) + OBJALIGN-1) & ~(OBJALIGN-1))
+
+// Free list link of obj, in the last word of its slot.
+#define LINK(c, obj) (*(void**)((char*)(obj) + (c)->size - sizeof(void*)))
+
+void
+slabinit(struct slabcache *c, char *name, uint size, void (*ctor)(void*))
+{
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + sizeof(void*) + OBJALIGN-1) & ~(OBJALIGN-1);
+  if(c->size > PGSIZE - SLABHDR)
+    panic("slabinit: size");
+  c->perslab = (PGSIZE - SLABHDR) / c->size;
+  c->ctor = ctor;
+}
+
+static void
+unlink(struct slabcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+linkhead(struct slabcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+// Make a new slab with all objects constructed and free.
+// Caller holds c->lock.
+static struct slab*
+newslab(struct slabcache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->free = 0;
+  s->inuse = 0;
+  obj = (char*)s + SLABHDR;
+  for(i = c->perslab - 1; i >= 0; i--){
+    if(c->ctor)
+      c->ctor(obj + i*c->size);
+    LINK(c, obj + i*c->size) = s->free;
+    s->free = obj + i*c->size;
+  }
+  c->nslab++;
+  linkhead(c, s);
+  return s;
+}
+
+// Move up to n objects from the slabs to the stack of this CPU.
+// Caller holds c->lock.
+static void
+refill(struct slabcache *c, int n)
+{
+  struct slab *s;
+  void *obj;
+  int id;
+
+  id = cpuid();
+  while(n-- > 0){
+    if((s = c->partial) == 0 && (s = newslab(c)) == 0)
+      break;
+    obj = s->free;
+    s->free = LINK(c, obj);
+    s->inuse++;
+    if(s->free == 0)
+      unlink(c, s);
+    c->cpu[id].obj[c->cpu[id].n++] = obj;
+  }
+}
+
+// Move n objects from the stack of this CPU back to their
+// slabs, and give pages of empty slabs back to kalloc.
+// Caller holds c->lock.
+static void
+drain(struct slabcache *c, int n)
+{
+  struct slab *s;
+  void *obj;
+  int id;
+
+  id = cpuid();
+  while(n-- > 0 && c->cpu[id].n > 0){
+    obj = c->cpu[id].obj[--c->cpu[id].n];
+    s = (struct slab*)PGROUNDDOWN((uint)obj);
+    if(s->cache != c)
+      panic("slabfree: wrong cache");
+    if(s->free == 0)
+      linkhead(c, s);
+    LINK(c, obj) = s->free;
+    s->free = obj;
+    // Keep one empty slab around, so a cache that is used a
+    // little doesn't allocate and free a page over and over.
+    if(--s->inuse == 0 && (c->partial != s || s->next != 0)){
+      unlink(c, s);
+      c->nslab--;
+      kfree((char*)s);
+    }
+  }
+}
+
+// Allocate an object from c. Returns 0 if out of memory.
+void*
+slaballoc(struct slabcache *c)
+{
+  void *obj;
+  int id;
+
+  pushcli();
+  id = cpuid();
+  if(c->cpu[id].n == 0){
+    acquire(&c->lock);
+    refill(c, SLABBATCH);
+    release(&c->lock);
+  }
+  obj = 0;
+  if(c->cpu[id].n > 0)
+    obj = c->cpu[id].obj[--c->cpu[id].n];
+  popcli();
+  return obj;
+}
+
+// Free an object allocated from c.
+void
+slabfree(struct slabcache *c, void *obj)
+{
+  int id;
+
+  pushcli();
+  id = cpuid();
+  if(c->cpu[id].n == SLABMAG){
+    acquire(&c->lock);
+    drain(c, SLABBATCH);
+    release(&c->lock);
+  }
+  c->cpu[id].obj[c->cpu[id].n++] = obj;
+  popcli();
+}
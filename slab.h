@@ -0,0 +1,21 @@
+// Object cache for kernel structures smaller than a page.
+// See slab.c.
+
+#define SLABMAG 16           // objects kept per CPU
+
+struct slabcache {
+  struct spinlock lock;
+  char *name;                // Name of cache.
+  uint size;                 // Slot size: object and free link
+  uint perslab;              // Objects per slab page
+  void (*ctor)(void*);       // Constructor, or 0
+  struct slab *partial;      // Slabs with free objects
+  uint nslab;                // Slab pages in use
+
+  // Per-CPU stacks of free objects, so most allocations
+  // don't take the lock.
+  struct {
+    void *obj[SLABMAG];
+    int n;
+  } cpu[NCPU];
+};
@@ -31,6 +31,23 @@ acquiresleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+// Take lk if it is free, without sleeping.
+// Returns 1 on success, 0 if somebody holds it.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = !lk->locked;
+  if(r){
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+  }
+  release(&lk->lk);
+  return r;
+}
+
 void
 releasesleep(struct sleeplock *lk)
 {
@@ -0,0 +1,13 @@
+// File actions for spawn(). The child starts with a copy of the
+// parent's open files; the actions are then applied in order to
+// the child's table. A list ends with a SPAWN_END action.
+#define SPAWN_END    0  // end of the action list
+#define SPAWN_DUP2   1  // make fd refer to the same file as srcfd
+#define SPAWN_CLOSE  2  // close fd
+#define SPAWN_MAXACT 32 // most actions in one list
+
+struct spawnfd {
+  int op;
+  int fd;
+  int srcfd;
+};
@@ -17,9 +17,12 @@
 int
 fetchint(uint addr, int *ip)
 {
-  struct proc *curproc = myproc();
+  uint end;
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  end = uvmend(myproc(), addr);
+  if(addr >= end || addr+4 > end)
+    return -1;
+  if(uvmprefault(myproc(), addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -32,13 +35,16 @@ int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
-  struct proc *curproc = myproc();
+  uint end;
 
-  if(addr >= curproc->sz)
+  if((end = uvmend(myproc(), addr)) == 0)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)end;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       uvmprefault(myproc(), (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -52,23 +58,45 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+argbuf(int n, char **pp, int size, int write)
 {
   int i;
+  uint end;
   struct proc *curproc = myproc();
 
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  end = uvmend(curproc, i);
+  if(size < 0 || (uint)i >= end || (uint)i+size > end)
+    return -1;
+  if(uvmprefault(curproc, i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process's memory, and fault in its
+// pages now so the kernel can use them while holding locks,
+// and so that running out of memory fails the system call
+// rather than panicking in a kernel page fault.
+int
+argptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 0);
+}
+
+// Like argptr, for memory the kernel is going to write:
+// also copies copy-on-write pages, and fails if the
+// memory is read-only.
+int
+argptrw(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -106,6 +134,10 @@ extern int sys_uptime(void);
 extern int sys_nice(void);
 extern int sys_halt(void);
 extern int sys_ps(void);
+extern int sys_getruntime(void);
+extern int sys_spawn(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -132,6 +164,10 @@ static int (*syscalls[])(void) = {
 [SYS_nice]    sys_nice,
 [SYS_halt]    sys_halt,
 [SYS_ps]      sys_ps,
+[SYS_getruntime] sys_getruntime,
+[SYS_spawn]   sys_spawn,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
 };
 
 void
@@ -23,3 +23,7 @@
 #define SYS_nice   22
 #define SYS_halt   23
 #define SYS_ps     24
+#define SYS_getruntime 25
+#define SYS_spawn  26
+#define SYS_mmap   27
+#define SYS_munmap 28
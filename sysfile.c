@@ -14,7 +14,9 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "spawn.h"
 #include "fcntl.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -73,7 +75,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptrw(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -109,7 +111,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argptrw(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -393,19 +395,19 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the nth word-sized system call argument as a
+// null-terminated argument vector of at most MAXARG strings.
+static int
+argargv(int n, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argint(n, (int*)&uargv) < 0)
     return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -416,9 +418,48 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+
+  if(argstr(0, &path) < 0 || argargv(1, argv) < 0){
+    return -1;
+  }
   return exec(path, argv);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  struct spawnfd acts[SPAWN_MAXACT];
+  uint uacts;
+  int n;
+
+  if(argstr(0, &path) < 0 || argargv(1, argv) < 0 ||
+     argint(2, (int*)&uacts) < 0)
+    return -1;
+  // A null action list leaves the files as they are.
+  n = 0;
+  if(uacts != 0){
+    for(;; n++, uacts += sizeof(acts[0])){
+      if(n >= NELEM(acts))
+        return -1;
+      if(fetchint(uacts, &acts[n].op) < 0 ||
+         fetchint(uacts+4, &acts[n].fd) < 0 ||
+         fetchint(uacts+8, &acts[n].srcfd) < 0)
+        return -1;
+      if(acts[n].op == SPAWN_END)
+        break;
+    }
+  }
+  return spawn(path, argv, acts, n);
+}
+
 int
 sys_pipe(void)
 {
@@ -426,7 +467,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptrw(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -442,3 +483,50 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_mmap(void)
+{
+  int addr, len, prot, flags, off, vflags, type;
+  struct file *f;
+  struct inode *ip;
+
+  // The address is only a hint, and ignored.
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || !(prot & PROT_READ))
+    return -1;
+  if(!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+    return -1;
+  vflags = 0;
+  if(prot & PROT_WRITE)
+    vflags |= VMA_WRITE;
+  if(flags & MAP_SHARED)
+    vflags |= VMA_SHARED;
+
+  ip = 0;
+  if(!(flags & MAP_ANONYMOUS)){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((vflags & VMA_SHARED) && (vflags & VMA_WRITE) && !f->writable)
+      return -1;
+    ip = f->ip;
+    ilock(ip);
+    type = ip->type;
+    iunlock(ip);
+    if(type != T_FILE)
+      return -1;
+  }
+  return mmap(myproc(), len, vflags, ip, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return munmap(myproc(), addr, len);
+}
@@ -102,6 +102,7 @@ sys_nice(void)
 int
 sys_halt(void)
 {
+  logflush();
   outw(0x604, 0x2000);
   return 0;
 }
@@ -111,3 +112,13 @@ sys_ps(void)
 {
   return ps();
 }
+
+int
+sys_getruntime(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getruntime(pid);
+}
@@ -46,7 +46,12 @@ trap(struct trapframe *tf)
     return;
   }
 
-  switch(tf->trapno){
+  // The virtio disk's interrupt is whatever the BIOS assigned,
+  // so it can't be a case label below.
+  if(virtioirq >= 0 && tf->trapno == T_IRQ0 + virtioirq){
+    virtiointr();
+    lapiceoi();
+  } else switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
       acquire(&tickslock);
@@ -71,6 +76,10 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_TLB:
+    tlbintr();
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -78,6 +87,13 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Faults the VM system can fix, like writes to copy-on-write
+    // pages, are retried. Anything else is handled below.
+    if(myproc() != 0 && pgfault(myproc(), rcr2(), tf->err) == 0)
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
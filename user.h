@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct spawnfd;
 
 // system calls
 int fork(void);
@@ -26,6 +27,10 @@ int uptime(void);
 int nice(int);
 int halt(void);
 int ps(void);
+int getruntime(int);
+int spawn(char*, char**, struct spawnfd*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
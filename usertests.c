@@ -4,6 +4,7 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "mman.h"
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
@@ -1144,6 +1145,63 @@ bigwrite(void)
   printf(1, "bigwrite ok\n");
 }
 
+// File data goes through the journal, so blocks that look like
+// log descriptors end up in the log ring. Write many of them,
+// each claiming a different sequence number and asking for block 1
+// (the superblock) to be overwritten. The data must read back
+// intact, and recovery at the next boot must not mistake a stale
+// one for a record: the descriptor checksum does not match.
+#define LOGMAGIC 0x6c6f6721
+#define NLOGMAGIC 100
+
+void
+logmagictest(void)
+{
+  uint *w;
+  int fd, i, k;
+
+  printf(1, "logmagic test\n");
+
+  unlink("logmagic");
+  fd = open("logmagic", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create logmagic\n");
+    exit();
+  }
+  w = (uint*)buf;
+  for(k = 0; k < NLOGMAGIC; k++){
+    for(i = 0; i < 512/sizeof(uint); i++)
+      w[i] = k;
+    w[0] = LOGMAGIC;  // magic
+    w[1] = k;         // seq
+    w[2] = 0;         // checksum
+    w[3] = 1;         // number of blocks
+    w[4] = 1;         // home location
+    if(write(fd, buf, 512) != 512){
+      printf(1, "logmagic write %d failed\n", k);
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("logmagic", O_RDONLY);
+  if(fd < 0){
+    printf(1, "cannot open logmagic\n");
+    exit();
+  }
+  for(k = 0; k < NLOGMAGIC; k++){
+    if(read(fd, buf, 512) != 512 || w[0] != LOGMAGIC || w[1] != k ||
+       w[4] != 1 || w[5] != k){
+      printf(1, "logmagic read %d failed\n", k);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("logmagic");
+
+  printf(1, "logmagic ok\n");
+}
+
 void
 bigfile(void)
 {
@@ -1737,6 +1795,133 @@ void argptest()
   printf(1, "arg test passed\n");
 }
 
+// file and anonymous mappings, private and shared.
+void
+mmaptest(void)
+{
+  int fd, i, pid, n;
+  char *p;
+
+  printf(stdout, "mmap test\n");
+  for(i = 0; i < 6000; i++)
+    buf[i] = 'a' + i % 26;
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, 6000) != 6000){
+    printf(stdout, "mmap test: create failed\n");
+    exit();
+  }
+
+  // Private: the file is visible, writes are not written back.
+  p = mmap(0, 6000, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap test: private mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < 6000; i++){
+    if(p[i] != buf[i]){
+      printf(stdout, "mmap test: wrong data at %d\n", i);
+      exit();
+    }
+  }
+  // Past the end of the file the last page reads as zero.
+  if(p[6000] != 0 || p[8191] != 0){
+    printf(stdout, "mmap test: no zeros after end of file\n");
+    exit();
+  }
+  p[0] = 'X';
+  if(munmap(p, 6000) < 0){
+    printf(stdout, "mmap test: munmap failed\n");
+    exit();
+  }
+
+  // Shared: writes reach the file after munmap.
+  p = mmap(0, 6000, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap test: shared mmap failed\n");
+    exit();
+  }
+  p[1] = 'Y';
+  p[5000] = 'Z';
+  if(munmap(p, 6000) < 0){
+    printf(stdout, "mmap test: munmap failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  unlink("mmapfile");
+  if(n != 6000 || buf[0] != 'a' || buf[1] != 'Y' || buf[5000] != 'Z'){
+    printf(stdout, "mmap test: shared writes not written back\n");
+    exit();
+  }
+
+  // write() to a file with a shared mapping shows in the mapping,
+  // and writing back the mapping keeps what write() wrote.
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, 6000) != 6000){
+    printf(stdout, "mmap test: create failed\n");
+    exit();
+  }
+  p = mmap(0, 6000, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED || p[4500] != buf[4500]){
+    printf(stdout, "mmap test: shared mmap failed\n");
+    exit();
+  }
+  p[10] = 'M';
+  close(fd);
+  fd = open("mmapfile", O_RDWR);
+  for(i = 0; i < 4100; i++)
+    buf[i] = 'W';
+  if(fd < 0 || write(fd, buf, 4100) != 4100){
+    printf(stdout, "mmap test: write failed\n");
+    exit();
+  }
+  close(fd);
+  if(p[0] != 'W' || p[10] != 'W' || p[4099] != 'W'){
+    printf(stdout, "mmap test: write not seen through mapping\n");
+    exit();
+  }
+  p[20] = 'M';
+  if(munmap(p, 6000) < 0){
+    printf(stdout, "mmap test: munmap failed\n");
+    exit();
+  }
+  fd = open("mmapfile", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  unlink("mmapfile");
+  if(n != 6000 || buf[0] != 'W' || buf[20] != 'M' || buf[4099] != 'W' ||
+     buf[4100] != 'a' + 4100 % 26){
+    printf(stdout, "mmap test: write overwritten by mapping\n");
+    exit();
+  }
+
+  // Anonymous shared memory is shared with children.
+  p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED || p[0] != 0 || p[4096] != 0){
+    printf(stdout, "mmap test: anonymous mmap failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "mmap test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    p[4096] = 42;
+    exit();
+  }
+  wait();
+  if(p[4096] != 42){
+    printf(stdout, "mmap test: anonymous pages not shared\n");
+    exit();
+  }
+  munmap(p, 2*4096);
+  printf(stdout, "mmap test ok\n");
+}
+
 unsigned long randstate = 1;
 unsigned int
 rand()
@@ -1768,6 +1953,7 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  mmaptest();
   validatetest();
 
   opentest();
@@ -1787,6 +1973,7 @@ main(int argc, char *argv[])
   rmdot();
   fourteen();
   bigfile();
+  logmagictest();
   subdir();
   linktest();
   unlinkread();
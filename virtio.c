@@ -0,0 +1,287 @@
+// Driver for a virtio block device (virtio-blk), using the
+// legacy PCI transport. QEMU provides one with
+//   -device virtio-blk-pci,drive=...
+// ideinit() looks for it at boot; if present, it serves
+// disk 1 (the file system) in place of the IDE disk.
+//
+// Requests go through one virtqueue: a ring of descriptors
+// the driver fills in, an "available" ring of requests for the
+// device and a "used" ring of finished ones. Several requests
+// can be outstanding; a batch is made available together and
+// the device is notified once, and one interrupt finishes
+// every request that is done by then.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+
+// Legacy virtio PCI registers, relative to BAR0.
+#define VIRTIO_FEATURES     0x00  // device features
+#define VIRTIO_GFEATURES    0x04  // features the driver uses
+#define VIRTIO_QADDR        0x08  // queue address / PGSIZE
+#define VIRTIO_QSIZE        0x0c
+#define VIRTIO_QSEL         0x0e
+#define VIRTIO_QNOTIFY      0x10
+#define VIRTIO_STATUS       0x12
+#define VIRTIO_ISR          0x13
+
+// Device status bits.
+#define VIRTIO_ACK          0x1
+#define VIRTIO_DRIVER       0x2
+#define VIRTIO_DRIVER_OK    0x4
+
+#define VIRTIO_VENDOR       0x1af4
+#define VIRTIO_BLK          0x1001  // legacy block device
+
+#define VIRTIO_BLK_T_IN     0       // read
+#define VIRTIO_BLK_T_OUT    1       // write
+
+#define VRING_F_NEXT        1       // descriptor continues via next
+#define VRING_F_WRITE       2       // device writes (vs reads)
+
+#define NVDESC   256  // most descriptors the driver supports
+#define VMERGE    16  // most blocks per request
+
+struct vdesc {
+  uint addr;          // physical address, low 32 bits
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+
+struct vused {
+  uint id;            // head descriptor of finished request
+  uint len;
+};
+
+struct vreq {
+  uint type;          // VIRTIO_BLK_T_IN or OUT
+  uint reserved;
+  uint sector;        // 64 bits on the device
+  uint sectorhi;
+  uchar status;       // written by the device, 0 means ok
+  struct buf *b;      // first buf, others linked through qnext
+};
+
+// The queue must be physically contiguous and page aligned,
+// so it lives in the kernel's bss rather than in kalloc pages.
+static char vring[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static struct {
+  struct spinlock lock;
+  ushort iobase;
+  uint n;                // queue size chosen by the device
+  struct vdesc *desc;
+  ushort *avail;         // flags, idx, ring[n]
+  volatile ushort *used; // flags, idx, then struct vused[n]
+  ushort lastused;       // used ring entries already handled
+  ushort free[NVDESC];   // stack of free descriptors
+  uint nfree;
+  struct vreq req[NVDESC]; // by head descriptor
+} virtio;
+
+int virtioirq = -1;
+
+#define USEDIDX() (virtio.used[1])
+#define USEDRING() ((volatile struct vused*)(virtio.used + 2))
+
+// Find and set up the device. Returns 0 if there is none.
+int
+virtioinit(void)
+{
+  struct pcidev pci;
+  uint n, usedoff;
+
+  if(!pcifindid(VIRTIO_VENDOR, VIRTIO_BLK, &pci) ||
+     (pci.bar[0] & PCI_BAR_IO) == 0)
+    return 0;
+  pcienable(&pci);
+  initlock(&virtio.lock, "virtio");
+  virtio.iobase = PCI_BAR_IOADDR(pci.bar[0]);
+
+  outb(virtio.iobase+VIRTIO_STATUS, 0);  // reset
+  outb(virtio.iobase+VIRTIO_STATUS, VIRTIO_ACK);
+  outb(virtio.iobase+VIRTIO_STATUS, VIRTIO_ACK|VIRTIO_DRIVER);
+  outl(virtio.iobase+VIRTIO_GFEATURES, 0);
+
+  // The legacy layout: descriptors, then the available ring,
+  // then the used ring at the next page boundary.
+  outw(virtio.iobase+VIRTIO_QSEL, 0);
+  n = inw(virtio.iobase+VIRTIO_QSIZE);
+  usedoff = PGROUNDUP(16*n + 2*(3+n));
+  if(n < VMERGE+2 || n > NVDESC || usedoff + 2*3 + 8*n > sizeof(vring)){
+    cprintf("virtio: bad queue size %d\n", n);
+    outb(virtio.iobase+VIRTIO_STATUS, 0);
+    return 0;
+  }
+  virtio.n = n;
+  memset(vring, 0, sizeof(vring));
+  virtio.desc = (struct vdesc*)vring;
+  virtio.avail = (ushort*)(vring + 16*n);
+  virtio.used = (ushort*)(vring + usedoff);
+  for(virtio.nfree = 0; virtio.nfree < n; virtio.nfree++)
+    virtio.free[virtio.nfree] = virtio.nfree;
+  outl(virtio.iobase+VIRTIO_QADDR, V2P(vring) / PGSIZE);
+
+  outb(virtio.iobase+VIRTIO_STATUS,
+       VIRTIO_ACK|VIRTIO_DRIVER|VIRTIO_DRIVER_OK);
+
+  // PCI INTx lines are level-triggered. The BIOS routes them to
+  // an ISA interrupt, which QEMU's PIIX chipset drives active
+  // high, so only the trigger mode differs from ISA devices.
+  virtioirq = pci.irq;
+  ioapicenablelevel(virtioirq, ncpu - 1);
+  cprintf("virtio: disk at %x irq %d, queue size %d\n",
+          virtio.iobase, virtioirq, n);
+  return 1;
+}
+
+// Queue one request for the chain of n bufs at b, which are
+// for consecutive blocks in the same direction.
+// Caller must hold virtio.lock.
+static void
+vstart(struct buf *b, int n)
+{
+  struct vreq *r;
+  struct vdesc *d;
+  int head, i, write;
+  struct buf *q;
+
+  while(virtio.nfree < n + 2){
+    // Let the device see what is queued so far, or
+    // nothing would ever free a descriptor.
+    outw(virtio.iobase+VIRTIO_QNOTIFY, 0);
+    sleep(&virtio.nfree, &virtio.lock);
+  }
+
+  write = (b->flags & B_DIRTY) != 0;
+  head = virtio.free[--virtio.nfree];
+  r = &virtio.req[head];
+  r->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  r->reserved = 0;
+  r->sector = b->blockno * (BSIZE/512);
+  r->sectorhi = 0;
+  r->status = 0xff;
+  r->b = b;
+
+  d = &virtio.desc[head];
+  d->addr = V2P(r);
+  d->addrhi = 0;
+  d->len = 16;
+  d->flags = VRING_F_NEXT;
+  for(q = b, i = 0; i <= n; i++){
+    d->next = virtio.free[--virtio.nfree];
+    d = &virtio.desc[d->next];
+    d->addrhi = 0;
+    if(i < n){
+      d->addr = V2P(q->data);
+      d->len = BSIZE;
+      d->flags = VRING_F_NEXT | (write ? 0 : VRING_F_WRITE);
+      q = q->qnext;
+    } else {
+      d->addr = V2P(&r->status);
+      d->len = 1;
+      d->flags = VRING_F_WRITE;
+    }
+  }
+
+  virtio.avail[2 + virtio.avail[1] % virtio.n] = head;
+  __sync_synchronize();
+  virtio.avail[1]++;
+}
+
+// Start I/O on n locked bufs, like idesubmit() in ide.c.
+// Runs of consecutive blocks become one request.
+void
+virtiosubmit(struct buf **bufs, int n)
+{
+  struct buf *b;
+  int i, j;
+
+  acquire(&virtio.lock);
+  for(i = 0; i < n; i = j){
+    for(j = i; j < n; j++){
+      b = bufs[j];
+      if(!holdingsleep(&b->lock))
+        panic("iderw: buf not locked");
+      if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+        panic("iderw: nothing to do");
+      if(b->blockno >= FSSIZE)
+        panic("incorrect blockno");
+      b->qnext = 0;
+      if(j > i && (j - i == VMERGE || b->blockno != bufs[j-1]->blockno + 1 ||
+         (b->flags & B_DIRTY) != (bufs[i]->flags & B_DIRTY)))
+        break;
+      if(j > i)
+        bufs[j-1]->qnext = b;
+    }
+    vstart(bufs[i], j - i);
+  }
+  __sync_synchronize();
+  outw(virtio.iobase+VIRTIO_QNOTIFY, 0);
+  release(&virtio.lock);
+}
+
+// Wait for a buf submitted without a done callback.
+void
+virtiosync(struct buf *b)
+{
+  acquire(&virtio.lock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &virtio.lock);
+  release(&virtio.lock);
+}
+
+// Interrupt handler: finish every request the device is done with.
+void
+virtiointr(void)
+{
+  struct vreq *r;
+  struct buf *b, *next;
+  void (*done)(struct buf*);
+  int d;
+
+  acquire(&virtio.lock);
+  inb(virtio.iobase+VIRTIO_ISR);  // acknowledge
+
+  while(virtio.lastused != USEDIDX()){
+    __sync_synchronize();
+    d = USEDRING()[virtio.lastused % virtio.n].id;
+    virtio.lastused++;
+    r = &virtio.req[d];
+    if(r->status != 0)
+      panic("virtio: I/O error");
+
+    for(b = r->b; b; b = next){
+      next = b->qnext;
+      b->flags |= B_VALID;
+      b->flags &= ~B_DIRTY;
+      if(b->done){
+        done = b->done;
+        b->done = 0;
+        done(b);
+      } else
+        wakeup(b);
+    }
+
+    // Free the descriptor chain.
+    for(;;){
+      virtio.free[virtio.nfree++] = d;
+      if((virtio.desc[d].flags & VRING_F_NEXT) == 0)
+        break;
+      d = virtio.desc[d].next;
+    }
+  }
+  wakeup(&virtio.nfree);
+  release(&virtio.lock);
+}
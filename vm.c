@@ -6,6 +6,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -42,10 +43,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -92,13 +92,13 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, found
+// at boot by meminit) (directly addressable from end..P2V(phystop)).
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -110,38 +110,75 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Like mappages, but map whole 4MB stretches with a single
+// PTE_PS directory entry. That needs no page table and one
+// TLB entry instead of a thousand. Used for the kernel's maps.
+static int
+mapkpages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  char *a;
+
+  a = (char*)PGROUNDDOWN((uint)va);
+  size = PGROUNDUP(size);
+  while(size > 0){
+    if((uint)a % PTSIZE == 0 && pa % PTSIZE == 0 && size >= PTSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS;
+      a += PTSIZE;
+      pa += PTSIZE;
+      size -= PTSIZE;
+    } else {
+      if(mappages(pgdir, a, PGSIZE, pa, perm) < 0)
+        return -1;
+      a += PGSIZE;
+      pa += PGSIZE;
+      size -= PGSIZE;
+    }
+  }
+  return 0;
+}
+
+// Set up a page table with only the kernel part, shared by all
+// page tables: the kernel mappings never change after boot, so
+// a new page table just copies kpgdir's directory entries above
+// KERNBASE and points at the same page tables.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memset(pgdir, 0, PDX(KERNBASE) * sizeof(pde_t));
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
-// Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// Allocate the kernel part of the address space, used on its
+// own by the scheduler and shared by every process.
+// Only the first 4MB, which holds the read-only kernel text,
+// needs a page table; the rest of physical memory and the
+// device space are mapped with 4MB pages.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
-  switchkvm();
+  struct kmap *k;
+
+  kmap[2].phys_end = phystop;  // kern data+memory
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkpages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
+  // Too early for switchkvm(): mycpu() needs mpinit().
+  lcr3(V2P(kpgdir));
 }
 
 // Switch h/w page table register to the kernel-only page table,
@@ -149,7 +186,28 @@ kvmalloc(void)
 void
 switchkvm(void)
 {
+  pushcli();
   lcr3(V2P(kpgdir));   // switch to the kernel page table
+  mycpu()->pgdir = kpgdir;
+  popcli();
+}
+
+// Point the TSS at p's kernel stack. Caller must have
+// interrupts disabled.
+static void
+settss(struct proc *p)
+{
+  if(p->kstack == 0)
+    panic("settss: no kstack");
+  mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
+                                sizeof(mycpu()->ts)-1, 0);
+  mycpu()->gdt[SEG_TSS].s = 0;
+  mycpu()->ts.ss0 = SEG_KDATA << 3;
+  mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
+  // forbids I/O instructions (e.g., inb and outb) from user space
+  mycpu()->ts.iomb = (ushort) 0xFFFF;
+  ltr(SEG_TSS << 3);
 }
 
 // Switch TSS and h/w page table to correspond to process p.
@@ -164,19 +222,67 @@ switchuvm(struct proc *p)
     panic("switchuvm: no pgdir");
 
   pushcli();
-  mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
-                                sizeof(mycpu()->ts)-1, 0);
-  mycpu()->gdt[SEG_TSS].s = 0;
-  mycpu()->ts.ss0 = SEG_KDATA << 3;
-  mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
-  // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
-  // forbids I/O instructions (e.g., inb and outb) from user space
-  mycpu()->ts.iomb = (ushort) 0xFFFF;
-  ltr(SEG_TSS << 3);
+  settss(p);
   lcr3(V2P(p->pgdir));  // switch to process's address space
+  mycpu()->pgdir = p->pgdir;
   popcli();
 }
 
+// Switch to process p from the scheduler, which does not go
+// back to kpgdir after a process runs. If the page table still
+// loaded is p's and p has not run on another CPU since, which
+// might have changed its mappings, this CPU's TLB is still good
+// for p and the %cr3 reload and TLB flush are skipped.
+// Called with interrupts disabled.
+void
+schedswitchuvm(struct proc *p)
+{
+  struct cpu *c;
+
+  if(p->pgdir == 0)
+    panic("schedswitchuvm: no pgdir");
+  c = mycpu();
+  settss(p);
+  if(c->pgdir != p->pgdir || p->lastcpu != c){
+    lcr3(V2P(p->pgdir));
+    c->pgdir = p->pgdir;
+  }
+  p->lastcpu = c;
+}
+
+// Make sure no CPU still has pgdir loaded, so that it can be
+// freed. The scheduler leaves the last process's page table
+// loaded, so any CPU that ran the owner may still use it: ask
+// those to switch to kpgdir with an IPI and wait until they do.
+// Nobody loads pgdir again, as its owner has exited or exec'd.
+// If another CPU has pgdir, interrupts must be enabled.
+static void
+tlbshootdown(pde_t *pgdir)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c->pgdir != pgdir)
+      continue;
+    pushcli();
+    lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+    popcli();
+    while(c->pgdir == pgdir)
+      ;
+  }
+}
+
+// TLB shootdown IPI: drop a page table that the scheduler
+// left loaded when no process is using it any more.
+void
+tlbintr(void)
+{
+  struct cpu *c = mycpu();
+
+  if(c->proc == 0 || c->pgdir != c->proc->pgdir)
+    switchkvm();
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -186,36 +292,11 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -231,13 +312,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -279,7 +359,7 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. The kernel part is shared with kpgdir.
 void
 freevm(pde_t *pgdir)
 {
@@ -287,8 +367,9 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
+  tlbshootdown(pgdir);
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -310,40 +391,443 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
-pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+// Map the pages of [start, end) in pgdir into d as well.
+// Unless share is set, writable pages become copy-on-write.
+static int
+copyrange(pde_t *pgdir, pde_t *d, uint start, uint end, int share)
 {
-  pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
-  if((d = setupkvm()) == 0)
-    return 0;
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = start; i < end; i += PGSIZE){
+    // Pages that were never touched are not mapped yet.
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+      continue;
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if(!share && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
-    }
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      return -1;
+    kref(P2V(pa));
   }
+  return 0;
+}
+
+// Given a parent process's page table, create a copy
+// of it for a child. Pages are shared copy-on-write: writable
+// pages lose PTE_W in both page tables and get PTE_COW, and the
+// first write to one makes a private copy (see cowpage).
+// The parent's mmap() regions in vma are copied too; pages of
+// MAP_SHARED regions stay writable and shared.
+pde_t*
+copyuvm(pde_t *pgdir, uint sz, struct vma *vma)
+{
+  pde_t *d;
+  struct vma *v;
+
+  if((d = setupkvm()) == 0)
+    return 0;
+  if(copyrange(pgdir, d, 0, sz, 0) < 0)
+    goto bad;
+  for(v = vma; v < &vma[NVMA]; v++)
+    if((v->flags & VMA_MMAP) &&
+       copyrange(pgdir, d, v->start, v->end, v->flags & VMA_SHARED) < 0)
+      goto bad;
+  // The parent's page table is the current one, and its
+  // writable pages just became read-only.
+  lcr3(rcr3());
   return d;
 
 bad:
+  lcr3(rcr3());
   freevm(d);
   return 0;
 }
 
+// Give pgdir a private, writable copy of the copy-on-write page
+// at va. If nobody else maps the page any more it is reused.
+// Returns 0 on success, -1 if va is not a copy-on-write page
+// or there is no memory for the copy.
+static int
+cowpage(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  if(krefcount(P2V(pa)) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | PTE_FLAGS(*pte);
+    kfree(P2V(pa));
+  }
+  *pte = (*pte | PTE_W) & ~PTE_COW;
+  invlpg((void*)va);
+  return 0;
+}
+
+// Map a fresh zeroed page at va, which is part of a process's
+// heap that sbrk() reserved without allocating.
+static int
+lazypage(pde_t *pgdir, uint va)
+{
+  char *mem;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end != 0 && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Can the current fault handler sleep, or was the kernel
+// holding a spinlock when it touched user memory?
+static int
+cansleep(void)
+{
+  int n;
+
+  pushcli();
+  n = mycpu()->ncli;
+  popcli();
+  return n == 1;
+}
+
+// Map the page at va of the region v.
+// Whole pages of file data come from the page cache and are
+// shared by everyone running the same file, copy-on-write if
+// the region is writable and private. The page holding the end
+// of the file data and the pages after it, and all pages of
+// anonymous regions, are private.
+static int
+filepage(struct proc *p, struct vma *v, uint va, uint err)
+{
+  uint pgoff, perm;
+  char *mem;
+
+  pgoff = va - v->start;
+  perm = PTE_U;
+  if(pgoff + PGSIZE <= v->filesz){
+    if((mem = pcacheget(v->ip, v->off + pgoff)) == 0){
+      if(!cansleep())
+        return -1;
+      ilock(v->ip);
+      mem = pcacheread(v->ip, v->off + pgoff);
+      iunlock(v->ip);
+      if(mem == 0)
+        return -1;
+    }
+    if(v->flags & VMA_SHARED){
+      if(v->flags & VMA_WRITE)
+        perm |= PTE_W;
+    } else if(v->flags & VMA_WRITE)
+      perm |= PTE_COW;
+  } else {
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    if(pgoff < v->filesz){
+      if(!cansleep()){
+        kfree(mem);
+        return -1;
+      }
+      ilock(v->ip);
+      readi(v->ip, mem, v->off + pgoff, v->filesz - pgoff);
+      iunlock(v->ip);
+    }
+    if(v->flags & VMA_WRITE)
+      perm |= PTE_W;
+  }
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  if((err & FEC_WR) && (perm & PTE_COW))
+    return cowpage(p->pgdir, va);
+  return 0;
+}
+
+// Try to resolve a page fault at va taken by process p,
+// from user mode or from the kernel touching user memory.
+// err is the fault's error code. Returns 0 if the faulting
+// access can be retried, -1 if the fault is a real error.
+int
+pgfault(struct proc *p, uint va, uint err)
+{
+  pte_t *pte;
+  struct vma *v;
+
+  if(va >= KERNBASE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walkpgdir(p->pgdir, (void*)va, 0);
+  if(pte == 0 || !(*pte & PTE_P)){
+    // The page is part of a region that has not been
+    // touched yet, or heap below p->sz.
+    if((v = findvma(p, va)) != 0)
+      return filepage(p, v, va, err);
+    if(va < p->sz)
+      return lazypage(p->pgdir, va);
+    return -1;
+  }
+  // User code may not touch pages without PTE_U, like the stack
+  // guard page, even if they are copy-on-write.
+  if((err & FEC_U) && !(*pte & PTE_U))
+    return -1;
+  if((err & FEC_WR) && (*pte & PTE_COW))
+    return cowpage(p->pgdir, va);
+  return -1;
+}
+
+// Fault in the pages of [va, va+n) that p has not touched yet,
+// and if write is set, copy its copy-on-write pages, before the
+// kernel uses them. A fault in the kernel could not sleep while
+// a lock is held, and panics if it runs out of memory; this
+// returns -1 instead, also if write is set and a page is
+// read-only.
+int
+uvmprefault(struct proc *p, uint va, uint n, int write)
+{
+  uint a, err;
+  pte_t *pte;
+
+  err = write ? FEC_WR : 0;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || !(*pte & PTE_P) || (write && (*pte & PTE_COW))){
+      if(pgfault(p, a, err) < 0)
+        return -1;
+      pte = walkpgdir(p->pgdir, (char*)a, 0);
+    }
+    if(write && !(*pte & PTE_W))
+      return -1;
+  }
+  return 0;
+}
+
+// Return the end of the user memory of p that va is part of:
+// p->sz for the image and heap, the end of the region for mmap()
+// regions. Returns 0 if va is not user memory of p.
+uint
+uvmend(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  if(va < p->sz)
+    return p->sz;
+  if((v = findvma(p, va)) != 0)
+    return v->end;
+  return 0;
+}
+
+// Find the highest free range of len bytes between the heap
+// and MMAPTOP for a new mapping. Returns 0 if there is none.
+static uint
+mmapaddr(struct proc *p, uint len)
+{
+  uint top, start, best;
+  struct vma *v;
+  int i;
+
+  best = 0;
+  for(i = 0; i <= NVMA; i++){
+    // Try to end the range at MMAPTOP or below a region.
+    if(i == NVMA)
+      top = MMAPTOP;
+    else if(p->vma[i].flags & VMA_MMAP)
+      top = p->vma[i].start;
+    else
+      continue;
+    if(top < len)
+      continue;
+    start = top - len;
+    if(start < PGROUNDUP(p->sz) || start <= best)
+      continue;
+    for(v = p->vma; v < &p->vma[NVMA]; v++)
+      if((v->flags & VMA_MMAP) && start < v->end && v->start < top)
+        break;
+    if(v == &p->vma[NVMA])
+      best = start;
+  }
+  return best;
+}
+
+// Add a region of len bytes to p, backed by ip from offset off,
+// or zeroed memory if ip is 0. flags are VMA_WRITE and VMA_SHARED.
+// Returns the address of the region, or -1.
+int
+mmap(struct proc *p, uint len, int flags, struct inode *ip, uint off)
+{
+  struct vma *v;
+  uint start, a;
+
+  if(len == 0 || len > MMAPTOP || off % PGSIZE != 0)
+    return -1;
+  len = PGROUNDUP(len);
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end == 0)
+      break;
+  if(v == &p->vma[NVMA])
+    return -1;
+  if((start = mmapaddr(p, len)) == 0)
+    return -1;
+
+  v->start = start;
+  v->end = start + len;
+  v->ip = ip ? idup(ip) : 0;
+  v->off = off;
+  v->filesz = ip ? len : 0;
+  v->flags = VMA_MMAP | flags;
+
+  // Shared anonymous pages can't be found again by a later fault
+  // in another process, so allocate them now for fork to share.
+  if(ip == 0 && (flags & VMA_SHARED)){
+    for(a = start; a < v->end; a += PGSIZE){
+      if(filepage(p, v, a, 0) < 0){
+        munmap(p, start, len);
+        return -1;
+      }
+    }
+  }
+  return start;
+}
+
+// Write the dirty pages of [start, end) of the region v back
+// to its file, if it is a shared file mapping.
+static void
+writeback(struct proc *p, struct vma *v, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+
+  if(v->ip == 0 || !(v->flags & VMA_SHARED) || !(v->flags & VMA_WRITE))
+    return;
+  for(a = start; a < end; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    pcachewrite(v->ip, v->off + (a - v->start), P2V(PTE_ADDR(*pte)));
+    *pte &= ~PTE_D;
+  }
+}
+
+// Remove [addr, addr+len) from the mmap() regions of p, writing
+// back dirty pages of shared file mappings. The range must lie
+// inside one region. Returns 0 on success, -1 on error.
+int
+munmap(struct proc *p, uint addr, uint len)
+{
+  struct vma *v, *nv;
+  uint end;
+
+  len = PGROUNDUP(len);
+  end = addr + len;
+  if(addr % PGSIZE != 0 || len == 0 || end < addr)
+    return -1;
+  if((v = findvma(p, addr)) == 0 || !(v->flags & VMA_MMAP) || end > v->end)
+    return -1;
+
+  // Punching a hole splits the region in two.
+  nv = 0;
+  if(addr > v->start && end < v->end){
+    for(nv = p->vma; nv < &p->vma[NVMA]; nv++)
+      if(nv->end == 0)
+        break;
+    if(nv == &p->vma[NVMA])
+      return -1;
+  }
+
+  writeback(p, v, addr, end);
+  deallocuvm(p->pgdir, end, addr);
+  lcr3(rcr3());
+
+  if(nv){
+    *nv = *v;
+    nv->start = end;
+    nv->off += end - v->start;
+    if(nv->ip){
+      idup(nv->ip);
+      nv->filesz = nv->end - nv->start;
+    }
+    v->end = addr;
+  } else if(addr == v->start && end == v->end){
+    if(v->ip){
+      begin_op();
+      iput(v->ip);
+      end_op();
+    }
+    memset(v, 0, sizeof(*v));
+    return 0;
+  } else if(addr == v->start){
+    v->off += end - v->start;
+    v->start = end;
+  } else
+    v->end = addr;
+  if(v->ip)
+    v->filesz = v->end - v->start;
+  return 0;
+}
+
+// Write back the dirty pages of all shared file mappings of p,
+// before its address space goes away in exit() or exec().
+void
+vmaflush(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->flags & VMA_MMAP)
+      writeback(p, v, v->start, v->end);
+}
+
+// Copy the regions of a parent to its child.
+void
+vmadup(struct vma *dst, struct vma *src)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    dst[i] = src[i];
+    if(src[i].end != 0 && src[i].ip)
+      idup(src[i].ip);
+  }
+}
+
+// Drop all regions in vma and their file references.
+// Must be called inside a transaction, like iput().
+void
+vmarelease(struct vma *vma)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    if(vma[i].end != 0 && vma[i].ip)
+      iput(vma[i].ip);
+    memset(&vma[i], 0, sizeof(vma[i]));
+  }
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -352,7 +836,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -367,10 +851,16 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // Writing through the kernel mapping would bypass the
+    // write protection of a copy-on-write page.
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowpage(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;